@@ -119,6 +119,14 @@ int16_t _jr_viscaRead16FromBuffer(uint8_t *buffer) {
     return result;
 }
 
+/**
+ * `buffer` looks like 0x0a 0x0b
+ * Returned result will look like 0xab
+ */
+uint8_t _jr_viscaRead8FromBuffer(uint8_t *buffer) {
+    return ((buffer[0] & 0xf) << 4) | (buffer[1] & 0xf);
+}
+
 /**
  * Given `value` looks like 0x1234
  * `buffer` will look like 0x01 0x02 0x03 0x04
@@ -234,6 +242,14 @@ void jr_visca_handlePanTiltDriveParameters(jr_viscaFrame* frame, union jr_viscaM
     }
 }
 
+void jr_visca_handleBlockInqResponseParameters(jr_viscaFrame* frame, union jr_viscaMessageParameters *messageParameters, bool isDecodingFrame) {
+    if (isDecodingFrame) {
+        memcpy(messageParameters->blockInqResponseParameters.data, frame->data + 1, JR_VISCA_BLOCK_INQ_RESPONSE_DATA_LENGTH);
+    } else {
+        memcpy(frame->data + 1, messageParameters->blockInqResponseParameters.data, JR_VISCA_BLOCK_INQ_RESPONSE_DATA_LENGTH);
+    }
+}
+
 jr_viscaMessageDefinition definitions[] = {
     {
         {0x09, 0x06, 0x12}, //signature
@@ -397,7 +413,7 @@ jr_viscaMessageDefinition definitions[] = {
         {0xf0},
         1,
         JR_VISCA_MESSAGE_CANCEL,
-        NULL
+        &jr_visca_handleAckCompletionParameters
     },
     {
         {0x60, 0x04},
@@ -406,6 +422,55 @@ jr_viscaMessageDefinition definitions[] = {
         JR_VISCA_MESSAGE_CANCEL_REPLY,
         &jr_visca_handleAckCompletionParameters
     },
+    {   // Syntax error 90 6y 02 FF
+        {0x60, 0x02},
+        {0xf0, 0xff},
+        2,
+        JR_VISCA_MESSAGE_SYNTAX_ERROR,
+        &jr_visca_handleAckCompletionParameters
+    },
+    {   // Command buffer full 90 6y 03 FF
+        {0x60, 0x03},
+        {0xf0, 0xff},
+        2,
+        JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL,
+        &jr_visca_handleAckCompletionParameters
+    },
+    {   // Command not executable 90 6y 41 FF
+        {0x60, 0x41},
+        {0xf0, 0xff},
+        2,
+        JR_VISCA_MESSAGE_COMMAND_NOT_EXECUTABLE,
+        &jr_visca_handleAckCompletionParameters
+    },
+    {   // No socket 90 6y 05 FF
+        {0x60, 0x05},
+        {0xf0, 0xff},
+        2,
+        JR_VISCA_MESSAGE_NO_SOCKET,
+        &jr_visca_handleAckCompletionParameters
+    },
+    {   // Lens control block inquiry 81 09 7E 7E 00 FF
+        {0x09, 0x7e, 0x7e, 0x00},
+        {0xff, 0xff, 0xff, 0xff},
+        4,
+        JR_VISCA_MESSAGE_LENS_BLOCK_INQ,
+        NULL
+    },
+    {   // Camera control block inquiry 81 09 7E 7E 01 FF
+        {0x09, 0x7e, 0x7e, 0x01},
+        {0xff, 0xff, 0xff, 0xff},
+        4,
+        JR_VISCA_MESSAGE_CAMERA_BLOCK_INQ,
+        NULL
+    },
+    {   // Block inquiry reply 90 50 + 13 bytes FF, layout depends on the inquiry.
+        {0x50, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+        {0xff, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+        14,
+        JR_VISCA_MESSAGE_BLOCK_INQ_RESPONSE,
+        &jr_visca_handleBlockInqResponseParameters
+    },
     { {}, {}, 0, 0, NULL} // Final definition must have `signatureLength` == 0.
 };
 
@@ -426,7 +491,10 @@ int jr_viscaDecodeFrame(jr_viscaFrame frame, union jr_viscaMessageParameters *me
     while (definitions[i].signatureLength) {
         uint8_t maskedFrame[JR_VISCA_MAX_ENCODED_MESSAGE_DATA_LENGTH - 2];
         _jr_viscaMemAnd(frame.data, definitions[i].signatureMask, maskedFrame, frame.dataLength);
-        if (memcmp(maskedFrame, definitions[i].signature, definitions[i].signatureLength) == 0) {
+        // Replies such as COMPLETION (50) and the position inquiry responses (50 0p 0q ...) share a prefix,
+        // so the frame length has to match exactly as well.
+        if (frame.dataLength == definitions[i].signatureLength &&
+            memcmp(maskedFrame, definitions[i].signature, definitions[i].signatureLength) == 0) {
             if (definitions[i].handleParameters != NULL) {
                 definitions[i].handleParameters(&frame, messageParameters, true);
             }
@@ -462,6 +530,43 @@ int jr_viscaEncodeFrame(int messageType, union jr_viscaMessageParameters message
     return -1;
 }
 
+int jr_viscaDecodeBlockInqResponse(int inquiry, struct jr_viscaBlockInqResponseParameters *parameters, struct jr_viscaCameraStatus *status) {
+    uint8_t *data = parameters->data;
+    switch (inquiry) {
+        case JR_VISCA_MESSAGE_LENS_BLOCK_INQ:
+            // [0]0u 0u 0u 0u [4]0v 0v [6]0w 0w 0w 0w [10]00 [11]xx [12]0z
+            status->zoomPosition = _jr_viscaRead16FromBuffer(data);
+            status->focusNearLimit = _jr_viscaRead8FromBuffer(data + 4);
+            status->focusPosition = _jr_viscaRead16FromBuffer(data + 6);
+            status->focusMode = (data[11] & 0x01) ? JR_VISCA_FOCUS_MODE_AUTOMATIC : JR_VISCA_FOCUS_MODE_MANUAL;
+            status->afSensitivityLow = (data[11] >> 1) & 0x1;
+            status->digitalZoom = (data[11] >> 2) & 0x1;
+            status->afMode = (data[11] >> 3) & 0x3;
+            status->zooming = data[12] & 0x1;
+            status->focusing = (data[12] >> 1) & 0x1;
+            status->memoryRecalling = (data[12] >> 2) & 0x1;
+            status->lowContrast = (data[12] >> 3) & 0x1;
+            return 0;
+        case JR_VISCA_MESSAGE_CAMERA_BLOCK_INQ:
+            // [0]0p 0p [2]0q 0q [4]0r [5]0s [6]tt [7]0u [8]vv [9]ww [10]0x 0x [12]0z
+            status->rGain = _jr_viscaRead8FromBuffer(data);
+            status->bGain = _jr_viscaRead8FromBuffer(data + 2);
+            status->whiteBalanceMode = data[4] & 0xf;
+            status->apertureGain = data[5] & 0xf;
+            status->exposureMode = data[6];
+            status->slowShutter = data[7] & 0x1;
+            status->exposureComp = (data[7] >> 1) & 0x1;
+            status->backLight = (data[7] >> 2) & 0x1;
+            status->shutterPosition = data[8];
+            status->irisPosition = data[9];
+            status->brightPosition = _jr_viscaRead8FromBuffer(data + 10);
+            status->exposureCompPosition = data[12] & 0xf;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
 int jr_viscaDecodeMessage(uint8_t *data, int dataLength, int *message, union jr_viscaMessageParameters *messageParameters, uint8_t *sender, uint8_t *receiver) {
     jr_viscaFrame frame;
     int consumedBytes = jr_viscaDataToFrame(data, dataLength, &frame);
@@ -486,3 +591,124 @@ int jr_viscaEncodeMessage(uint8_t *data, int dataLength, int message, union jr_v
 
     return jr_viscaFrameToData(data, dataLength, frame);
 }
+
+int jr_viscaMessageIsInquiry(int message) {
+    switch (message) {
+        case JR_VISCA_MESSAGE_PAN_TILT_POSITION_INQ:
+        case JR_VISCA_MESSAGE_ZOOM_POSITION_INQ:
+        case JR_VISCA_MESSAGE_LENS_BLOCK_INQ:
+        case JR_VISCA_MESSAGE_CAMERA_BLOCK_INQ:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Inquiries and CANCEL are answered without taking a command socket.
+ */
+bool _jr_viscaFlowControlIgnores(int message) {
+    return message == JR_VISCA_MESSAGE_CANCEL || jr_viscaMessageIsInquiry(message);
+}
+
+void jr_viscaFlowControlInit(struct jr_viscaFlowControl *flowControl, int maxInFlight) {
+    if (maxInFlight <= 0) {
+        maxInFlight = JR_VISCA_FLOW_CONTROL_DEFAULT_MAX_IN_FLIGHT;
+    }
+    flowControl->inFlight = 0;
+    flowControl->window = maxInFlight;
+    flowControl->maxInFlight = maxInFlight;
+    flowControl->ceiling = 0;
+    flowControl->fullWindowAckCount = 0;
+    flowControl->successCount = 0;
+    flowControl->backoffMs = 0;
+    flowControl->resumeAtMs = 0;
+}
+
+int jr_viscaFlowControlCanSend(struct jr_viscaFlowControl *flowControl, uint32_t nowMs) {
+    if (flowControl->inFlight >= flowControl->window) {
+        return 0;
+    }
+    // Signed difference so that a wrapped millisecond counter still compares correctly.
+    if (flowControl->backoffMs && (int32_t)(nowMs - flowControl->resumeAtMs) < 0) {
+        return 0;
+    }
+    return 1;
+}
+
+void jr_viscaFlowControlCommandSent(struct jr_viscaFlowControl *flowControl, int message) {
+    if (_jr_viscaFlowControlIgnores(message)) {
+        return;
+    }
+    flowControl->inFlight++;
+}
+
+void jr_viscaFlowControlCommandAbandoned(struct jr_viscaFlowControl *flowControl, int message) {
+    if (_jr_viscaFlowControlIgnores(message)) {
+        return;
+    }
+    if (flowControl->inFlight > 0) {
+        flowControl->inFlight--;
+    }
+}
+
+int jr_viscaFlowControlHandleReply(struct jr_viscaFlowControl *flowControl, int message, int inReplyTo, uint32_t nowMs) {
+    if (_jr_viscaFlowControlIgnores(inReplyTo)) {
+        return message == JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL ? JR_VISCA_FLOW_CONTROL_RETRY : JR_VISCA_FLOW_CONTROL_NONE;
+    }
+
+    switch (message) {
+        case JR_VISCA_MESSAGE_ACK: {
+            flowControl->successCount++;
+            if (flowControl->successCount >= JR_VISCA_FLOW_CONTROL_BACKOFF_RESET_ACKS) {
+                flowControl->backoffMs = 0;
+            }
+            // The overrun may have been transient (e.g. another controller holding a socket), so probe again eventually.
+            if (flowControl->successCount >= JR_VISCA_FLOW_CONTROL_CEILING_RESET_ACKS) {
+                flowControl->ceiling = 0;
+            }
+            // Only a window the camera kept up with while full is evidence that it can take one more.
+            if (flowControl->inFlight >= flowControl->window) {
+                flowControl->fullWindowAckCount++;
+            }
+            int limit = flowControl->ceiling ? flowControl->ceiling - 1 : flowControl->maxInFlight;
+            if (flowControl->fullWindowAckCount >= flowControl->window && flowControl->window < limit) {
+                flowControl->window++;
+                flowControl->fullWindowAckCount = 0;
+            }
+            return JR_VISCA_FLOW_CONTROL_NONE;
+        }
+        case JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL:
+            // Overrunning with a single command in flight says the camera was busy, not how many sockets it has.
+            if (flowControl->inFlight > 1) {
+                flowControl->ceiling = flowControl->inFlight;
+            }
+            if (flowControl->inFlight > 0) {
+                flowControl->inFlight--;
+            }
+            flowControl->window = flowControl->window > 1 ? flowControl->window / 2 : 1;
+            flowControl->fullWindowAckCount = 0;
+            flowControl->successCount = 0;
+            if (flowControl->backoffMs == 0) {
+                flowControl->backoffMs = JR_VISCA_FLOW_CONTROL_INITIAL_BACKOFF_MS;
+            } else if (flowControl->backoffMs < JR_VISCA_FLOW_CONTROL_MAX_BACKOFF_MS) {
+                flowControl->backoffMs *= 2;
+                if (flowControl->backoffMs > JR_VISCA_FLOW_CONTROL_MAX_BACKOFF_MS) {
+                    flowControl->backoffMs = JR_VISCA_FLOW_CONTROL_MAX_BACKOFF_MS;
+                }
+            }
+            flowControl->resumeAtMs = nowMs + flowControl->backoffMs;
+            return JR_VISCA_FLOW_CONTROL_RETRY;
+        case JR_VISCA_MESSAGE_COMPLETION:
+        case JR_VISCA_MESSAGE_CANCEL_REPLY:
+        case JR_VISCA_MESSAGE_SYNTAX_ERROR:
+        case JR_VISCA_MESSAGE_COMMAND_NOT_EXECUTABLE:
+            // Terminal replies: the camera is done with the command one way or another.
+            if (flowControl->inFlight > 0) {
+                flowControl->inFlight--;
+            }
+            return JR_VISCA_FLOW_CONTROL_NONE;
+        default:
+            return JR_VISCA_FLOW_CONTROL_NONE;
+    }
+}
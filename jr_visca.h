@@ -22,6 +22,10 @@
 
 #include <stdint.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define JR_VISCA_MAX_ENCODED_MESSAGE_DATA_LENGTH 18
 
 #define JR_VISCA_MESSAGE_PAN_TILT_POSITION_INQ 1
@@ -57,10 +61,29 @@
 
 #define JR_VISCA_MESSAGE_RESET 22
 
+// Cancel 8x 2y FF. The socket number (y) to cancel is set in `ackCompletionParameters`.
 #define JR_VISCA_MESSAGE_CANCEL 23
 
 #define JR_VISCA_MESSAGE_CANCEL_REPLY 24
 
+// Error replies, 6y 02 / 6y 03 / 6y 41. The socket number (y) is decoded into `ackCompletionParameters`.
+#define JR_VISCA_MESSAGE_SYNTAX_ERROR 25
+#define JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL 26
+#define JR_VISCA_MESSAGE_COMMAND_NOT_EXECUTABLE 27
+
+// Block inquiries, 8x 09 7E 7E 0n FF. Both are answered with BLOCK_INQ_RESPONSE (y0 50 + 13 bytes); pass
+// its parameters and the inquiry that was sent to `jr_viscaDecodeBlockInqResponse`. Neither block reports
+// pan/tilt, which still takes its own PAN_TILT_POSITION_INQ.
+#define JR_VISCA_MESSAGE_LENS_BLOCK_INQ 28
+#define JR_VISCA_MESSAGE_CAMERA_BLOCK_INQ 29
+#define JR_VISCA_MESSAGE_BLOCK_INQ_RESPONSE 30
+
+#define JR_VISCA_BLOCK_INQ_RESPONSE_DATA_LENGTH 13
+
+// No socket, 6y 05: typically the answer to a CANCEL for a socket that has already finished. The socket
+// number (y) is decoded into `ackCompletionParameters`.
+#define JR_VISCA_MESSAGE_NO_SOCKET 31
+
 struct jr_viscaPanTiltPositionInqResponseParameters {
     int16_t panPosition;
     int16_t tiltPosition;
@@ -130,6 +153,48 @@ struct jr_viscaPanTiltDriveParameters {
     uint8_t tiltDirection; // JR_VISCA_TILT_DIRECTION_*
 };
 
+// The 13 bytes following 50 in a block inquiry reply, as received.
+struct jr_viscaBlockInqResponseParameters {
+    uint8_t data[JR_VISCA_BLOCK_INQ_RESPONSE_DATA_LENGTH];
+};
+
+#define JR_VISCA_FOCUS_MODE_UNKNOWN 0
+#define JR_VISCA_FOCUS_MODE_AUTOMATIC 1
+#define JR_VISCA_FOCUS_MODE_MANUAL 2
+
+/**
+ * Camera state reported by block inquiries. Each inquiry fills in its own group of fields and leaves the
+ * others untouched, so one struct can be refreshed with both. Pan/tilt position is not covered by either.
+ */
+struct jr_viscaCameraStatus {
+    // Lens block: y0 50 0u 0u 0u 0u 0v 0v 0w 0w 0w 0w 00 xx 0z FF
+    int16_t zoomPosition; // uuuu
+    uint8_t focusNearLimit; // vv
+    int16_t focusPosition; // wwww
+    uint8_t focusMode; // xx bit 0, JR_VISCA_FOCUS_MODE_*
+    uint8_t afSensitivityLow; // xx bit 1
+    uint8_t digitalZoom; // xx bit 2
+    uint8_t afMode; // xx bits 3-4: 0=normal, 1=interval, 2=zoom trigger
+    uint8_t zooming; // z bit 0
+    uint8_t focusing; // z bit 1
+    uint8_t memoryRecalling; // z bit 2
+    uint8_t lowContrast; // z bit 3
+
+    // Camera block: y0 50 0p 0p 0q 0q 0r 0s tt 0u vv ww 0x 0x 0z FF
+    uint8_t rGain; // pp
+    uint8_t bGain; // qq
+    uint8_t whiteBalanceMode; // r
+    uint8_t apertureGain; // s
+    uint8_t exposureMode; // tt
+    uint8_t slowShutter; // u bit 0
+    uint8_t exposureComp; // u bit 1
+    uint8_t backLight; // u bit 2
+    uint8_t shutterPosition; // vv
+    uint8_t irisPosition; // ww
+    uint8_t brightPosition; // xx
+    uint8_t exposureCompPosition; // z
+};
+
 union jr_viscaMessageParameters
 {
     struct jr_viscaPanTiltPositionInqResponseParameters panTiltPositionInqResponseParameters;
@@ -141,6 +206,7 @@ union jr_viscaMessageParameters
     struct jr_viscaMemoryParameters memoryParameters;
     struct jr_viscaPresetSpeedParameters presetSpeedParameters;
     struct jr_viscaAbsolutePanTiltPositionParameters absolutePanTiltPositionParameters;
+    struct jr_viscaBlockInqResponseParameters blockInqResponseParameters;
 };
 
 /**
@@ -150,6 +216,8 @@ union jr_viscaMessageParameters
  * 
  * If the buffer contains at least one complete message (i.e. the return value is greater than 0):
  *  - `message` will either be set to -1 (unrecognized message) or one of the `JR_VISCA_MESSAGE_*` constants.
+ *    A frame must be exactly as long as a message's definition to match it; one with trailing bytes no longer
+ *    matches a shorter message it starts with (e.g. `50 0p 0p ...` is never taken for COMPLETION `50`).
  *  - `messageParameters` will have the corresponding parameters set as appropriate for the detected message type.
  */
 int jr_viscaDecodeMessage(uint8_t *data, int dataLength, int *message, union jr_viscaMessageParameters *messageParameters, uint8_t *sender, uint8_t *receiver);
@@ -161,4 +229,105 @@ int jr_viscaDecodeMessage(uint8_t *data, int dataLength, int *message, union jr_
  */
 int jr_viscaEncodeMessage(uint8_t *data, int dataLength, int message, union jr_viscaMessageParameters messageParameters, uint8_t sender, uint8_t receiver);
 
+/**
+ * Decodes a BLOCK_INQ_RESPONSE into `status`. `inquiry` is the block inquiry it answers
+ * (`JR_VISCA_MESSAGE_LENS_BLOCK_INQ` or `JR_VISCA_MESSAGE_CAMERA_BLOCK_INQ`); the replies have the same
+ * shape, so the caller has to say which one it asked for. Only that block's fields are written.
+ *
+ * Returns 0, or -1 if `inquiry` is not a block inquiry.
+ */
+int jr_viscaDecodeBlockInqResponse(int inquiry, struct jr_viscaBlockInqResponseParameters *parameters, struct jr_viscaCameraStatus *status);
+
+/**
+ * Returns 1 if `message` is an inquiry (`*_INQ`). Inquiries are answered directly, without ACK, COMPLETION
+ * or a command socket.
+ */
+int jr_viscaMessageIsInquiry(int message);
+
+/**
+ * Per-camera flow control.
+ *
+ * VISCA cameras only have a couple of command sockets. When they are all busy, the camera answers with
+ * COMMAND_BUFFER_FULL and drops the command. Keep one `jr_viscaFlowControl` per camera, ask it whether a
+ * command may be sent, and feed it every decoded reply from that camera. On a buffer-full reply the window
+ * of in-flight commands is halved, the number of commands in flight when it overran is remembered as a
+ * ceiling, and sending pauses with exponential backoff. The window grows back by one after a full window's
+ * worth of ACKs, but never to the ceiling, so the send rate settles just below what the camera can actually
+ * absorb instead of probing it over and over. The backoff is only cleared after a run of successful ACKs,
+ * and the ceiling after a much longer one.
+ *
+ * Inquiries don't occupy a command socket, so they are not counted and may be sent at any time, e.g. to
+ * poll position while the window is full of moves.
+ *
+ * The library does no I/O and keeps no clock: `nowMs` is any monotonic millisecond counter the caller
+ * likes. Wraparound is handled.
+ */
+#define JR_VISCA_FLOW_CONTROL_DEFAULT_MAX_IN_FLIGHT 2
+#define JR_VISCA_FLOW_CONTROL_INITIAL_BACKOFF_MS 10
+#define JR_VISCA_FLOW_CONTROL_MAX_BACKOFF_MS 1000
+// Consecutive ACKs needed after a buffer-full reply before the backoff starts over from its initial value.
+#define JR_VISCA_FLOW_CONTROL_BACKOFF_RESET_ACKS 8
+// Consecutive ACKs after which the ceiling is forgotten and the window may probe the camera again.
+#define JR_VISCA_FLOW_CONTROL_CEILING_RESET_ACKS 1024
+
+// Return values of `jr_viscaFlowControlHandleReply`.
+#define JR_VISCA_FLOW_CONTROL_NONE 0
+#define JR_VISCA_FLOW_CONTROL_RETRY 1
+
+struct jr_viscaFlowControl {
+    // Commands (not inquiries) sent but not yet answered with a completion or error.
+    int inFlight;
+    // Current limit on `inFlight`, 1-`maxInFlight`.
+    int window;
+    int maxInFlight;
+    // Commands in flight at the last overrun with more than one of them, 0 if none. The window stays below it.
+    int ceiling;
+    // ACKs received with the window full since it last changed.
+    int fullWindowAckCount;
+    // ACKs received since the last buffer-full reply.
+    int successCount;
+    // Delay applied on the last buffer-full reply; 0 until the first one, and again after a run of successes.
+    uint32_t backoffMs;
+    // Sending is paused until this time.
+    uint32_t resumeAtMs;
+};
+
+/**
+ * Initializes `flowControl`. `maxInFlight` is the number of command sockets on the camera, or 0 for
+ * `JR_VISCA_FLOW_CONTROL_DEFAULT_MAX_IN_FLIGHT`. Initializing again forgets the learned ceiling.
+ */
+void jr_viscaFlowControlInit(struct jr_viscaFlowControl *flowControl, int maxInFlight);
+
+/**
+ * Returns 1 if a command may be sent to the camera at `nowMs`, 0 if the caller should hold it.
+ */
+int jr_viscaFlowControlCanSend(struct jr_viscaFlowControl *flowControl, uint32_t nowMs);
+
+/**
+ * Records that `message` has been sent to the camera. Inquiries and CANCEL are ignored.
+ */
+void jr_viscaFlowControlCommandSent(struct jr_viscaFlowControl *flowControl, int message);
+
+/**
+ * Updates `flowControl` with a decoded reply from the camera.
+ *
+ * `inReplyTo` is the message the reply answers, or -1 if the caller doesn't track that. Replies to
+ * inquiries and to CANCEL, as well as inquiry responses, leave the window alone.
+ *
+ * Returns `JR_VISCA_FLOW_CONTROL_RETRY` if `message` is COMMAND_BUFFER_FULL: the command was dropped and
+ * should be sent again once `jr_viscaFlowControlCanSend` allows it. Otherwise returns `JR_VISCA_FLOW_CONTROL_NONE`.
+ */
+int jr_viscaFlowControlHandleReply(struct jr_viscaFlowControl *flowControl, int message, int inReplyTo, uint32_t nowMs);
+
+/**
+ * Frees the slot of a command the caller has given up on, e.g. after a timeout when a reply may have been
+ * lost. Replies that still turn up for it should not be passed to `jr_viscaFlowControlHandleReply`; if
+ * they are, the in-flight count is clamped at 0. Inquiries and CANCEL are ignored.
+ */
+void jr_viscaFlowControlCommandAbandoned(struct jr_viscaFlowControl *flowControl, int message);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,760 @@
+/*
+    Copyright 2021 Jacob Rau
+
+    This file is part of libjr_visca.
+
+    libjr_visca is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libjr_visca is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libjr_visca.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/**
+ * Optional C++20 coroutine facade over the C encoder/decoder. Linux only (epoll).
+ *
+ *     jr_visca::Task<> zoomTo(jr_visca::Camera &camera, int16_t zoomPosition) {
+ *         union jr_viscaMessageParameters parameters = {};
+ *         parameters.zoomPositionParameters.zoomPosition = zoomPosition;
+ *         jr_visca::Reply reply = co_await camera.command(JR_VISCA_MESSAGE_ZOOM_DIRECT, parameters);
+ *         // reply.status == jr_visca::Status::Completed once the camera sends COMPLETION.
+ *     }
+ *
+ *     jr_visca::Executor executor;
+ *     jr_visca::Camera camera(executor, fd);
+ *     executor.spawn(zoomTo(camera, 0x2000));
+ *     executor.run();
+ *
+ * Everything runs on the thread calling `Executor::run`. Each in-flight command is a stackless coroutine
+ * plus a small awaiter in its frame, so thousands of outstanding commands are cheap. Commands are queued
+ * per camera and released through `jr_viscaFlowControl`, so a camera answering COMMAND_BUFFER_FULL sees
+ * the dropped command again after the backoff instead of the caller getting an error. Inquiries don't
+ * take a command socket and are sent right away, so position can be polled while moves are running.
+ */
+
+#ifndef JR_VISCA_CORO_HPP
+#define JR_VISCA_CORO_HPP
+
+#include "jr_visca.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <optional>
+#include <stop_token>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace jr_visca {
+
+using Clock = std::chrono::steady_clock;
+
+template <typename T = void>
+class Task;
+
+/**
+ * Single-threaded event loop: epoll for readable file descriptors, an ordered map for timers and a
+ * queue of coroutines ready to resume.
+ */
+class Executor {
+public:
+    using Timer = std::pair<Clock::time_point, uint64_t>;
+
+    Executor() : epollFd_(epoll_create1(EPOLL_CLOEXEC)) {
+        if (epollFd_ < 0) {
+            throw std::system_error(errno, std::generic_category(), "epoll_create1");
+        }
+    }
+
+    ~Executor() {
+        close(epollFd_);
+    }
+
+    Executor(const Executor &) = delete;
+    Executor &operator=(const Executor &) = delete;
+
+    /**
+     * Calls `onReadable` from `run` whenever `fd` has data.
+     */
+    void watch(int fd, std::function<void()> onReadable) {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event) < 0) {
+            throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+        }
+        watchers_[fd] = std::move(onReadable);
+    }
+
+    void unwatch(int fd) {
+        epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+        watchers_.erase(fd);
+    }
+
+    /**
+     * Calls `callback` from `run` once `when` has passed. The returned handle can be passed to `cancelTimer`.
+     */
+    Timer addTimer(Clock::time_point when, std::function<void()> callback) {
+        Timer timer(when, nextTimerId_++);
+        timers_.emplace(timer, std::move(callback));
+        return timer;
+    }
+
+    /**
+     * Cancels a timer. Cancelling a timer that already fired is a no-op.
+     */
+    void cancelTimer(Timer timer) {
+        timers_.erase(timer);
+    }
+
+    /**
+     * Resumes `handle` from `run` on the next loop iteration.
+     */
+    void post(std::coroutine_handle<> handle) {
+        ready_.push_back(handle);
+    }
+
+    /**
+     * Starts `task` right away and lets it run to completion on its own. The task frame is freed when it
+     * finishes. Exceptions escaping `task` terminate the program.
+     */
+    void spawn(Task<void> task);
+
+    /**
+     * Runs until `stop` is called, or until there is nothing left to wait for.
+     */
+    void run() {
+        stopped_ = false;
+        while (!stopped_) {
+            while (!ready_.empty() && !stopped_) {
+                std::coroutine_handle<> handle = ready_.front();
+                ready_.pop_front();
+                handle.resume();
+            }
+            if (stopped_) {
+                break;
+            }
+
+            int timeoutMs = -1;
+            if (!timers_.empty()) {
+                Clock::duration wait = timers_.begin()->first.first - Clock::now();
+                timeoutMs = wait.count() <= 0 ? 0 : std::chrono::ceil<std::chrono::milliseconds>(wait).count();
+            } else if (watchers_.empty()) {
+                break;
+            }
+
+            epoll_event events[64];
+            int eventCount = epoll_wait(epollFd_, events, 64, timeoutMs);
+            if (eventCount < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(), "epoll_wait");
+            }
+            for (int i = 0; i < eventCount; i++) {
+                auto watcher = watchers_.find(events[i].data.fd);
+                if (watcher != watchers_.end()) {
+                    // Copy, since the callback may unwatch its own fd.
+                    std::function<void()> onReadable = watcher->second;
+                    onReadable();
+                }
+            }
+
+            Clock::time_point now = Clock::now();
+            while (!timers_.empty() && timers_.begin()->first.first <= now) {
+                std::function<void()> callback = std::move(timers_.begin()->second);
+                timers_.erase(timers_.begin());
+                callback();
+            }
+        }
+    }
+
+    void stop() {
+        stopped_ = true;
+    }
+
+private:
+    int epollFd_;
+    bool stopped_ = false;
+    uint64_t nextTimerId_ = 0;
+    std::unordered_map<int, std::function<void()>> watchers_;
+    std::map<Timer, std::function<void()>> timers_;
+    std::deque<std::coroutine_handle<>> ready_;
+};
+
+namespace detail {
+
+struct TaskPromiseBase {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr exception;
+
+    struct FinalAwaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            return handle.promise().continuation;
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+    void return_value(T result) { value = std::move(result); }
+    T result() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+    void result() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+}
+
+/**
+ * Lazily started coroutine. Awaiting it starts it and resumes the awaiter when it finishes.
+ */
+template <typename T>
+class Task {
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+    Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        handle_.promise().continuation = awaiting;
+        return handle_;
+    }
+    T await_resume() { return handle_.promise().result(); }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+template <typename T>
+Task<T> detail::TaskPromise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> detail::TaskPromise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+namespace detail {
+inline Detached runDetached(Task<void> task) {
+    co_await std::move(task);
+}
+}
+
+inline void Executor::spawn(Task<void> task) {
+    detail::runDetached(std::move(task));
+}
+
+enum class Status {
+    // COMPLETION, or the inquiry response, arrived.
+    Completed,
+    // The camera answered with SYNTAX_ERROR or COMMAND_NOT_EXECUTABLE, or the message could not be encoded.
+    Error,
+    // No answer before the timeout. A CANCEL was sent if the command had a socket. Also reported early when
+    // the camera reuses the command's socket, meaning its COMPLETION was lost.
+    Timeout,
+    // The stop token was triggered. A CANCEL was sent if the command had a socket.
+    Cancelled,
+    // The socket failed or was closed.
+    IoError
+};
+
+struct Reply {
+    Status status;
+    // COMPLETION, an *_INQ_RESPONSE, or one of the error replies. -1 if nothing was received.
+    int message;
+    union jr_viscaMessageParameters parameters;
+};
+
+/**
+ * One camera reachable through a connected socket speaking raw VISCA (e.g. PTZOptics TCP/UDP port).
+ * The caller keeps ownership of `fd`; it is switched to non-blocking mode.
+ *
+ * Replies are matched in VISCA order: the first reply to each message (ACK, inquiry response or error)
+ * arrives in send order, and COMPLETION is matched by socket number.
+ */
+class Camera {
+public:
+    class CommandAwaiter {
+    public:
+        CommandAwaiter(const CommandAwaiter &) = delete;
+        CommandAwaiter &operator=(const CommandAwaiter &) = delete;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            handle_ = handle;
+            camera_.submit(this);
+        }
+        Reply await_resume() const noexcept { return reply_; }
+
+    private:
+        friend class Camera;
+
+        enum class State { Queued, AwaitingReply, Executing, Done };
+
+        CommandAwaiter(Camera &camera, int message, union jr_viscaMessageParameters parameters, Clock::duration timeout, std::stop_token stopToken)
+            : camera_(camera), message_(message), parameters_(parameters), timeout_(timeout), stopToken_(std::move(stopToken)) {}
+
+        Camera &camera_;
+        int message_;
+        union jr_viscaMessageParameters parameters_;
+        Clock::duration timeout_;
+        std::stop_token stopToken_;
+        std::coroutine_handle<> handle_;
+        Reply reply_ = {Status::Completed, -1, {}};
+        State state_ = State::Queued;
+        int socket_ = 0;
+        Executor::Timer timer_;
+        std::optional<std::stop_callback<std::function<void()>>> stopCallback_;
+    };
+
+    Camera(Executor &executor, int fd, uint8_t sender = 0, uint8_t receiver = 1, int maxInFlight = 0)
+        : executor_(executor), fd_(fd), sender_(sender), receiver_(receiver) {
+        jr_viscaFlowControlInit(&flowControl_, maxInFlight);
+        int flags = fcntl(fd_, F_GETFL);
+        if (flags < 0 || fcntl(fd_, F_SETFL, flags | O_NONBLOCK) < 0) {
+            throw std::system_error(errno, std::generic_category(), "fcntl");
+        }
+        executor_.watch(fd_, [this]() { onReadable(); });
+        watching_ = true;
+    }
+
+    ~Camera() {
+        failAll(Status::Cancelled);
+        if (pumpTimerArmed_) {
+            executor_.cancelTimer(pumpTimer_);
+        }
+        if (watching_) {
+            executor_.unwatch(fd_);
+        }
+    }
+
+    Camera(const Camera &) = delete;
+    Camera &operator=(const Camera &) = delete;
+
+    /**
+     * Sends `message` and completes once the camera has finished with it: COMPLETION for commands, the
+     * response for inquiries, or an error reply.
+     *
+     * `stopToken` must be triggered from the executor's thread.
+     */
+    CommandAwaiter command(int message, union jr_viscaMessageParameters parameters = {}, Clock::duration timeout = std::chrono::seconds(5), std::stop_token stopToken = {}) {
+        return CommandAwaiter(*this, message, parameters, timeout, std::move(stopToken));
+    }
+
+private:
+    // First-reply queue entry. `op` is null for a CANCEL, or for a message abandoned before it was answered.
+    // `message` is -1 for an empty queue.
+    struct Outstanding {
+        CommandAwaiter *op;
+        int message;
+        bool isCancel;
+    };
+
+    static bool isInquiryResponse(int message) {
+        return message == JR_VISCA_MESSAGE_PAN_TILT_POSITION_INQ_RESPONSE || message == JR_VISCA_MESSAGE_ZOOM_POSITION_INQ_RESPONSE ||
+            message == JR_VISCA_MESSAGE_BLOCK_INQ_RESPONSE;
+    }
+
+    static uint32_t nowMs() {
+        return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    void submit(CommandAwaiter *op) {
+        op->state_ = CommandAwaiter::State::Queued;
+        queueFor(op).push_back(op);
+        op->timer_ = executor_.addTimer(Clock::now() + op->timeout_, [this, op]() { abandon(op, Status::Timeout); });
+        if (op->stopToken_.stop_possible()) {
+            op->stopCallback_.emplace(op->stopToken_, std::function<void()>([this, op]() {
+                if (op->state_ != CommandAwaiter::State::Done) {
+                    abandon(op, Status::Cancelled);
+                }
+            }));
+        }
+        pump();
+    }
+
+    void resolve(CommandAwaiter *op, Status status, int message, union jr_viscaMessageParameters parameters) {
+        if (op->state_ == CommandAwaiter::State::Done) {
+            return;
+        }
+        op->state_ = CommandAwaiter::State::Done;
+        op->reply_ = {status, message, parameters};
+        executor_.cancelTimer(op->timer_);
+        executor_.post(op->handle_);
+    }
+
+    void abandon(CommandAwaiter *op, Status status) {
+        switch (op->state_) {
+            case CommandAwaiter::State::Queued: {
+                std::deque<CommandAwaiter *> &queue = queueFor(op);
+                queue.erase(std::find(queue.begin(), queue.end(), op));
+                break;
+            }
+            case CommandAwaiter::State::AwaitingReply:
+                jr_viscaFlowControlCommandAbandoned(&flowControl_, op->message_);
+                for (auto outstanding = outstanding_.begin(); outstanding != outstanding_.end(); ++outstanding) {
+                    if (outstanding->op != op) {
+                        continue;
+                    }
+                    if (status == Status::Timeout) {
+                        // Nothing came back in the whole timeout, so the reply was lost (e.g. over UDP).
+                        // Waiting for it would pin every later reply to the wrong message.
+                        outstanding_.erase(outstanding);
+                    } else {
+                        // Leave a placeholder so the eventual ACK can be answered with a CANCEL.
+                        outstanding->op = nullptr;
+                    }
+                    break;
+                }
+                break;
+            case CommandAwaiter::State::Executing:
+                jr_viscaFlowControlCommandAbandoned(&flowControl_, op->message_);
+                // The socket may have been handed to a newer command since; cancelling it would kill that one.
+                if (sockets_[op->socket_] == op) {
+                    sockets_[op->socket_] = nullptr;
+                    sendCancel(op->socket_);
+                }
+                break;
+            case CommandAwaiter::State::Done:
+                return;
+        }
+        resolve(op, status, -1, {});
+        // A freed slot may let a queued command go out.
+        pump();
+    }
+
+    void failAll(Status status) {
+        for (std::deque<CommandAwaiter *> *queue : {&pendingInquiries_, &pendingCommands_}) {
+            while (!queue->empty()) {
+                CommandAwaiter *op = queue->front();
+                queue->pop_front();
+                resolve(op, status, -1, {});
+            }
+        }
+        for (Outstanding &outstanding : outstanding_) {
+            if (outstanding.op) {
+                resolve(outstanding.op, status, -1, {});
+            }
+        }
+        outstanding_.clear();
+        for (CommandAwaiter *&op : sockets_) {
+            if (op) {
+                resolve(op, status, -1, {});
+                op = nullptr;
+            }
+        }
+    }
+
+    bool sendData(uint8_t *data, int dataLength) {
+        return ::send(fd_, data, dataLength, MSG_NOSIGNAL) == dataLength;
+    }
+
+    void sendCancel(int socket) {
+        union jr_viscaMessageParameters parameters = {};
+        parameters.ackCompletionParameters.socketNumber = socket;
+        uint8_t data[JR_VISCA_MAX_ENCODED_MESSAGE_DATA_LENGTH];
+        int dataLength = jr_viscaEncodeMessage(data, sizeof(data), JR_VISCA_MESSAGE_CANCEL, parameters, sender_, receiver_);
+        if (dataLength > 0 && sendData(data, dataLength)) {
+            outstanding_.push_back({nullptr, JR_VISCA_MESSAGE_CANCEL, true});
+        }
+    }
+
+    // Inquiries don't take a command socket, so they get their own queue that the window never holds back.
+    std::deque<CommandAwaiter *> &queueFor(CommandAwaiter *op) {
+        return jr_viscaMessageIsInquiry(op->message_) ? pendingInquiries_ : pendingCommands_;
+    }
+
+    void send(CommandAwaiter *op) {
+        uint8_t data[JR_VISCA_MAX_ENCODED_MESSAGE_DATA_LENGTH];
+        int dataLength = jr_viscaEncodeMessage(data, sizeof(data), op->message_, op->parameters_, sender_, receiver_);
+        if (dataLength < 0) {
+            resolve(op, Status::Error, -1, {});
+            return;
+        }
+        if (!sendData(data, dataLength)) {
+            resolve(op, Status::IoError, -1, {});
+            return;
+        }
+        jr_viscaFlowControlCommandSent(&flowControl_, op->message_);
+        op->state_ = CommandAwaiter::State::AwaitingReply;
+        outstanding_.push_back({op, op->message_, false});
+    }
+
+    void pump() {
+        uint32_t now = nowMs();
+        bool inquiriesBackingOff = inquiryBackoffMs_ && (int32_t)(now - inquiryResumeAtMs_) < 0;
+        while (!pendingInquiries_.empty() && !inquiriesBackingOff) {
+            CommandAwaiter *op = pendingInquiries_.front();
+            pendingInquiries_.pop_front();
+            send(op);
+        }
+
+        while (!pendingCommands_.empty() && jr_viscaFlowControlCanSend(&flowControl_, now)) {
+            CommandAwaiter *op = pendingCommands_.front();
+            pendingCommands_.pop_front();
+            send(op);
+        }
+
+        // A full window reopens on the next reply; a backoff needs a timer.
+        std::optional<int32_t> delayMs;
+        if (!pendingCommands_.empty() && flowControl_.inFlight < flowControl_.window) {
+            delayMs = std::max((int32_t)(flowControl_.resumeAtMs - now), 0);
+        }
+        if (!pendingInquiries_.empty() && inquiriesBackingOff) {
+            delayMs = std::min(delayMs.value_or(INT32_MAX), (int32_t)(inquiryResumeAtMs_ - now));
+        }
+        if (!delayMs) {
+            return;
+        }
+        Clock::time_point when = Clock::now() + std::chrono::milliseconds(*delayMs);
+        if (pumpTimerArmed_) {
+            if (pumpTimer_.first <= when) {
+                return;
+            }
+            executor_.cancelTimer(pumpTimer_);
+        }
+        pumpTimerArmed_ = true;
+        pumpTimer_ = executor_.addTimer(when, [this]() {
+            pumpTimerArmed_ = false;
+            pump();
+        });
+    }
+
+    void onReadable() {
+        uint8_t buffer[256];
+        while (true) {
+            ssize_t readCount = ::recv(fd_, buffer, sizeof(buffer), 0);
+            if (readCount < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (readCount < 0 && errno == EINTR) {
+                continue;
+            }
+            if (readCount <= 0) {
+                executor_.unwatch(fd_);
+                watching_ = false;
+                failAll(Status::IoError);
+                return;
+            }
+            received_.insert(received_.end(), buffer, buffer + readCount);
+        }
+
+        size_t offset = 0;
+        while (offset < received_.size()) {
+            int message = -1;
+            union jr_viscaMessageParameters parameters = {};
+            uint8_t sender;
+            uint8_t receiver;
+            int consumed = jr_viscaDecodeMessage(received_.data() + offset, (int)(received_.size() - offset), &message, &parameters, &sender, &receiver);
+            if (consumed == 0) {
+                break;
+            }
+            if (consumed < 0) {
+                // Corrupt frame: drop everything up to and including its terminator.
+                auto terminator = std::find(received_.begin() + offset, received_.end(), 0xff);
+                offset = terminator == received_.end() ? received_.size() : terminator - received_.begin() + 1;
+                continue;
+            }
+            offset += consumed;
+            handleReply(message, parameters);
+        }
+        received_.erase(received_.begin(), received_.begin() + offset);
+        if (received_.size() > 1024) {
+            // No terminator in sight; this is not VISCA.
+            received_.clear();
+        }
+
+        pump();
+    }
+
+    /**
+     * Pops the message that `reply` answers. CANCELs whose own reply never arrived are skipped when `reply`
+     * can't be an answer to a CANCEL.
+     */
+    Outstanding popOutstanding(int reply) {
+        bool canAnswerCancel = reply == JR_VISCA_MESSAGE_SYNTAX_ERROR || reply == JR_VISCA_MESSAGE_COMMAND_NOT_EXECUTABLE;
+        while (!canAnswerCancel && !outstanding_.empty() && outstanding_.front().isCancel) {
+            outstanding_.pop_front();
+        }
+        if (outstanding_.empty()) {
+            return {nullptr, -1, false};
+        }
+        Outstanding outstanding = outstanding_.front();
+        outstanding_.pop_front();
+        return outstanding;
+    }
+
+    int updateFlowControl(int message, int inReplyTo) {
+        return jr_viscaFlowControlHandleReply(&flowControl_, message, inReplyTo, nowMs());
+    }
+
+    void handleReply(int message, union jr_viscaMessageParameters parameters) {
+        uint8_t socket = parameters.ackCompletionParameters.socketNumber & 0xf;
+
+        switch (message) {
+            // Replies to abandoned messages are not passed to flow control: their slot was freed in `abandon`.
+            case JR_VISCA_MESSAGE_ACK: {
+                if (CommandAwaiter *previous = sockets_[socket]) {
+                    // The camera only hands out a socket it has finished with, so the COMPLETION for the
+                    // command still holding it was lost. Report that now rather than at its timeout.
+                    jr_viscaFlowControlCommandAbandoned(&flowControl_, previous->message_);
+                    sockets_[socket] = nullptr;
+                    resolve(previous, Status::Timeout, -1, {});
+                }
+                Outstanding outstanding = popOutstanding(message);
+                if (outstanding.op) {
+                    updateFlowControl(message, outstanding.message);
+                    outstanding.op->state_ = CommandAwaiter::State::Executing;
+                    outstanding.op->socket_ = socket;
+                    sockets_[socket] = outstanding.op;
+                } else if (outstanding.message != -1) {
+                    // Abandoned before the camera accepted it.
+                    sendCancel(socket);
+                }
+                break;
+            }
+            case JR_VISCA_MESSAGE_COMPLETION:
+            case JR_VISCA_MESSAGE_CANCEL_REPLY:
+            case JR_VISCA_MESSAGE_NO_SOCKET: {
+                if (message != JR_VISCA_MESSAGE_COMPLETION && !outstanding_.empty() && outstanding_.front().isCancel) {
+                    outstanding_.pop_front();
+                }
+                CommandAwaiter *op = message == JR_VISCA_MESSAGE_NO_SOCKET ? nullptr : sockets_[socket];
+                if (op) {
+                    updateFlowControl(message, op->message_);
+                    sockets_[socket] = nullptr;
+                    resolve(op, message == JR_VISCA_MESSAGE_COMPLETION ? Status::Completed : Status::Cancelled, message, parameters);
+                }
+                break;
+            }
+            case JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL: {
+                Outstanding outstanding = popOutstanding(message);
+                if (outstanding.op && updateFlowControl(message, outstanding.message) == JR_VISCA_FLOW_CONTROL_RETRY) {
+                    if (jr_viscaMessageIsInquiry(outstanding.message)) {
+                        // Inquiries skip the flow-control window, so back them off here instead.
+                        inquiryBackoffMs_ = inquiryBackoffMs_ ? std::min<uint32_t>(inquiryBackoffMs_ * 2, JR_VISCA_FLOW_CONTROL_MAX_BACKOFF_MS) : JR_VISCA_FLOW_CONTROL_INITIAL_BACKOFF_MS;
+                        inquiryResumeAtMs_ = nowMs() + inquiryBackoffMs_;
+                    }
+                    outstanding.op->state_ = CommandAwaiter::State::Queued;
+                    queueFor(outstanding.op).push_front(outstanding.op);
+                }
+                break;
+            }
+            case JR_VISCA_MESSAGE_SYNTAX_ERROR:
+            case JR_VISCA_MESSAGE_COMMAND_NOT_EXECUTABLE: {
+                CommandAwaiter *op = nullptr;
+                int inReplyTo = -1;
+                if (socket != 0 && sockets_[socket]) {
+                    op = sockets_[socket];
+                    inReplyTo = op->message_;
+                    sockets_[socket] = nullptr;
+                } else {
+                    Outstanding outstanding = popOutstanding(message);
+                    op = outstanding.op;
+                    inReplyTo = outstanding.message;
+                }
+                if (op) {
+                    updateFlowControl(message, inReplyTo);
+                    resolve(op, Status::Error, message, parameters);
+                }
+                break;
+            }
+            default:
+                if (isInquiryResponse(message)) {
+                    inquiryBackoffMs_ = 0;
+                    CommandAwaiter *op = popOutstanding(message).op;
+                    if (op) {
+                        resolve(op, Status::Completed, message, parameters);
+                    }
+                } else if (!outstanding_.empty() && outstanding_.front().isCancel) {
+                    // Some cameras answer a CANCEL with a reply we don't decode.
+                    outstanding_.pop_front();
+                }
+                break;
+        }
+    }
+
+    Executor &executor_;
+    int fd_;
+    uint8_t sender_;
+    uint8_t receiver_;
+    bool watching_ = false;
+    struct jr_viscaFlowControl flowControl_;
+    bool pumpTimerArmed_ = false;
+    Executor::Timer pumpTimer_;
+    // Backoff for inquiries answered with COMMAND_BUFFER_FULL, as `jr_viscaFlowControl` does for commands.
+    uint32_t inquiryBackoffMs_ = 0;
+    uint32_t inquiryResumeAtMs_ = 0;
+    std::deque<CommandAwaiter *> pendingInquiries_;
+    std::deque<CommandAwaiter *> pendingCommands_;
+    std::deque<Outstanding> outstanding_;
+    std::array<CommandAwaiter *, 16> sockets_ = {};
+    std::vector<uint8_t> received_;
+};
+
+}
+
+#endif
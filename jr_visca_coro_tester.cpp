@@ -0,0 +1,304 @@
+#include <jr_visca_coro.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+void bail(int line, const char *message) {
+    fprintf(stderr, "line %d: %s\n", line, message);
+    exit(-1);
+}
+
+void assertEqualsInt(int actual, int expected, int line, const char *message) {
+    if (actual != expected) {
+        printf("expected %d, actual %d\n", expected, actual);
+        bail(line, message);
+    }
+}
+
+/**
+ * Minimal camera on the other end of a socketpair. It has `socketCount` command sockets and answers
+ * COMMAND_BUFFER_FULL when they are all busy. Completions are sent after `completionDelay`, or never if
+ * `completes` is false. The next `dropCount` messages are ignored, as if lost on the network, and so are the
+ * next `dropCompletionCount` completions (the socket is still freed). The next `inquiryBufferFullCount`
+ * zoom inquiries are answered with COMMAND_BUFFER_FULL.
+ */
+struct FakeCamera {
+    jr_visca::Executor &executor;
+    int fd;
+    int socketCount;
+    bool completes = true;
+    std::chrono::milliseconds completionDelay{0};
+    int dropCount = 0;
+    int dropCompletionCount = 0;
+    int inquiryBufferFullCount = 0;
+    int inquiryCount = 0;
+    bool busy[3] = {};
+    int bufferFullCount = 0;
+    int cancelCount = 0;
+
+    FakeCamera(jr_visca::Executor &executor, int fd, int socketCount) : executor(executor), fd(fd), socketCount(socketCount) {
+        executor.watch(fd, [this]() { onReadable(); });
+    }
+
+    ~FakeCamera() {
+        executor.unwatch(fd);
+    }
+
+    void reply(int message, uint8_t socket) {
+        union jr_viscaMessageParameters parameters = {};
+        parameters.ackCompletionParameters.socketNumber = socket;
+        reply(message, parameters);
+    }
+
+    void reply(int message, union jr_viscaMessageParameters parameters) {
+        uint8_t data[JR_VISCA_MAX_ENCODED_MESSAGE_DATA_LENGTH];
+        int dataLength = jr_viscaEncodeMessage(data, sizeof(data), message, parameters, 1, 0);
+        send(fd, data, dataLength, 0);
+    }
+
+    void onReadable() {
+        uint8_t data[JR_VISCA_MAX_ENCODED_MESSAGE_DATA_LENGTH];
+        ssize_t dataLength = recv(fd, data, sizeof(data), MSG_DONTWAIT);
+        if (dataLength <= 0) {
+            return;
+        }
+        if (dropCount > 0) {
+            dropCount--;
+            return;
+        }
+        int message;
+        union jr_viscaMessageParameters parameters;
+        uint8_t sender;
+        uint8_t receiver;
+        jr_viscaDecodeMessage(data, dataLength, &message, &parameters, &sender, &receiver);
+
+        if (message == JR_VISCA_MESSAGE_ZOOM_POSITION_INQ) {
+            inquiryCount++;
+            if (inquiryBufferFullCount > 0) {
+                inquiryBufferFullCount--;
+                reply(JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL, 0);
+                return;
+            }
+            union jr_viscaMessageParameters response = {};
+            response.zoomPositionParameters.zoomPosition = 0x1234;
+            reply(JR_VISCA_MESSAGE_ZOOM_POSITION_INQ_RESPONSE, response);
+        } else if (message == JR_VISCA_MESSAGE_CANCEL) {
+            uint8_t socket = parameters.ackCompletionParameters.socketNumber;
+            cancelCount++;
+            busy[socket] = false;
+            reply(JR_VISCA_MESSAGE_CANCEL_REPLY, socket);
+        } else {
+            uint8_t socket = 1;
+            while (socket <= socketCount && busy[socket]) {
+                socket++;
+            }
+            if (socket > socketCount) {
+                bufferFullCount++;
+                reply(JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL, 0);
+                return;
+            }
+            busy[socket] = true;
+            reply(JR_VISCA_MESSAGE_ACK, socket);
+            if (completes) {
+                executor.addTimer(jr_visca::Clock::now() + completionDelay, [this, socket]() {
+                    busy[socket] = false;
+                    if (dropCompletionCount > 0) {
+                        dropCompletionCount--;
+                        return;
+                    }
+                    reply(JR_VISCA_MESSAGE_COMPLETION, socket);
+                });
+            }
+        }
+    }
+};
+
+struct Fixture {
+    jr_visca::Executor executor;
+    int fds[2];
+    std::optional<jr_visca::Camera> camera;
+    std::optional<FakeCamera> fake;
+
+    Fixture(int cameraSockets, int maxInFlight) {
+        if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) < 0) {
+            bail(__LINE__, "socketpair failed");
+        }
+        camera.emplace(executor, fds[0], 0, 1, maxInFlight);
+        fake.emplace(executor, fds[1], cameraSockets);
+    }
+
+    ~Fixture() {
+        camera.reset();
+        fake.reset();
+        close(fds[0]);
+        close(fds[1]);
+    }
+};
+
+jr_visca::Task<> zoomTo(jr_visca::Camera &camera, int16_t zoomPosition, int *completed, int total, jr_visca::Executor &executor) {
+    union jr_viscaMessageParameters parameters = {};
+    parameters.zoomPositionParameters.zoomPosition = zoomPosition;
+    jr_visca::Reply reply = co_await camera.command(JR_VISCA_MESSAGE_ZOOM_DIRECT, parameters);
+    assertEqualsInt((int)reply.status, (int)jr_visca::Status::Completed, __LINE__, "zoom should complete");
+    assertEqualsInt(reply.message, JR_VISCA_MESSAGE_COMPLETION, __LINE__, "reply should be COMPLETION");
+    if (++*completed == total) {
+        executor.stop();
+    }
+}
+
+void testManyConcurrentCommands() {
+    Fixture fixture(2, 2);
+    const int total = 2000;
+    int completed = 0;
+    for (int i = 0; i < total; i++) {
+        fixture.executor.spawn(zoomTo(*fixture.camera, i, &completed, total, fixture.executor));
+    }
+    fixture.executor.run();
+    assertEqualsInt(completed, total, __LINE__, "every command should complete");
+    assertEqualsInt(fixture.fake->bufferFullCount, 0, __LINE__, "matching window should not overrun the camera");
+}
+
+void testBufferFullRetries() {
+    // Client believes the camera has 2 sockets, camera really has 1.
+    Fixture fixture(1, 2);
+    fixture.fake->completionDelay = std::chrono::milliseconds(2);
+    const int total = 20;
+    int completed = 0;
+    for (int i = 0; i < total; i++) {
+        fixture.executor.spawn(zoomTo(*fixture.camera, i, &completed, total, fixture.executor));
+    }
+    fixture.executor.run();
+    assertEqualsInt(completed, total, __LINE__, "dropped commands should be retried until they complete");
+    if (fixture.fake->bufferFullCount == 0) {
+        bail(__LINE__, "camera should have reported buffer full at least once");
+    }
+}
+
+jr_visca::Task<> inquireZoom(jr_visca::Camera &camera, jr_visca::Executor &executor) {
+    jr_visca::Reply reply = co_await camera.command(JR_VISCA_MESSAGE_ZOOM_POSITION_INQ);
+    assertEqualsInt((int)reply.status, (int)jr_visca::Status::Completed, __LINE__, "inquiry should complete");
+    assertEqualsInt(reply.message, JR_VISCA_MESSAGE_ZOOM_POSITION_INQ_RESPONSE, __LINE__, "reply should be the inquiry response");
+    assertEqualsInt(reply.parameters.zoomPositionParameters.zoomPosition, 0x1234, __LINE__, "zoom position should be decoded");
+    executor.stop();
+}
+
+void testInquiry() {
+    Fixture fixture(2, 2);
+    fixture.executor.spawn(inquireZoom(*fixture.camera, fixture.executor));
+    fixture.executor.run();
+}
+
+jr_visca::Task<> inquireZoomRecordingTime(jr_visca::Camera &camera, jr_visca::Clock::time_point *finishedAt) {
+    jr_visca::Reply reply = co_await camera.command(JR_VISCA_MESSAGE_ZOOM_POSITION_INQ);
+    assertEqualsInt((int)reply.status, (int)jr_visca::Status::Completed, __LINE__, "inquiry should complete");
+    *finishedAt = jr_visca::Clock::now();
+}
+
+void testInquiryBufferFullBacksOff() {
+    Fixture fixture(2, 2);
+    fixture.fake->inquiryBufferFullCount = 3;
+    jr_visca::Clock::time_point startedAt = jr_visca::Clock::now();
+    jr_visca::Clock::time_point finishedAt = startedAt;
+    fixture.executor.spawn(inquireZoomRecordingTime(*fixture.camera, &finishedAt));
+    fixture.executor.addTimer(startedAt + std::chrono::milliseconds(200), [&fixture]() { fixture.executor.stop(); });
+    fixture.executor.run();
+    assertEqualsInt(fixture.fake->inquiryCount, 4, __LINE__, "inquiry should be retried until it is answered");
+    // 10 + 20 + 40 ms of backoff before the three retries.
+    int elapsedMs = (int)std::chrono::duration_cast<std::chrono::milliseconds>(finishedAt - startedAt).count();
+    if (elapsedMs < JR_VISCA_FLOW_CONTROL_INITIAL_BACKOFF_MS * 7) {
+        printf("elapsed %d ms\n", elapsedMs);
+        bail(__LINE__, "retried inquiries should back off");
+    }
+}
+
+jr_visca::Task<> commandExpectingStatus(jr_visca::Camera &camera, int message, jr_visca::Status expected, std::chrono::milliseconds timeout, int *finished) {
+    jr_visca::Reply reply = co_await camera.command(message, {}, timeout);
+    assertEqualsInt((int)reply.status, (int)expected, __LINE__, "command should end with the expected status");
+    ++*finished;
+}
+
+void testRecoversFromLostReplies() {
+    Fixture fixture(2, 2);
+    fixture.fake->dropCount = 2;
+    int finished = 0;
+    // Enough lost commands to fill the whole window; a later command must still get through.
+    fixture.executor.spawn(commandExpectingStatus(*fixture.camera, JR_VISCA_MESSAGE_ZOOM_DIRECT, jr_visca::Status::Timeout, std::chrono::milliseconds(10), &finished));
+    fixture.executor.spawn(commandExpectingStatus(*fixture.camera, JR_VISCA_MESSAGE_ZOOM_DIRECT, jr_visca::Status::Timeout, std::chrono::milliseconds(10), &finished));
+    fixture.executor.spawn(commandExpectingStatus(*fixture.camera, JR_VISCA_MESSAGE_ZOOM_DIRECT, jr_visca::Status::Completed, std::chrono::milliseconds(100), &finished));
+    fixture.executor.addTimer(jr_visca::Clock::now() + std::chrono::milliseconds(50), [&fixture]() { fixture.executor.stop(); });
+    fixture.executor.run();
+    assertEqualsInt(finished, 3, __LINE__, "every command should have finished");
+}
+
+void testLostCompletionSocketReuse() {
+    // One socket, but the client may send two: the second command gets the socket the first one held.
+    Fixture fixture(1, 2);
+    fixture.fake->completionDelay = std::chrono::milliseconds(20);
+    fixture.fake->dropCompletionCount = 1;
+    int finished = 0;
+    jr_visca::Camera &camera = *fixture.camera;
+    // The first command's timeout falls while the second one is still executing.
+    fixture.executor.spawn(commandExpectingStatus(camera, JR_VISCA_MESSAGE_ZOOM_DIRECT, jr_visca::Status::Timeout, std::chrono::milliseconds(35), &finished));
+    fixture.executor.addTimer(jr_visca::Clock::now() + std::chrono::milliseconds(25), [&fixture, &camera, &finished]() {
+        fixture.executor.spawn(commandExpectingStatus(camera, JR_VISCA_MESSAGE_ZOOM_DIRECT, jr_visca::Status::Completed, std::chrono::milliseconds(200), &finished));
+    });
+    fixture.executor.addTimer(jr_visca::Clock::now() + std::chrono::milliseconds(100), [&fixture]() { fixture.executor.stop(); });
+    fixture.executor.run();
+    assertEqualsInt(finished, 2, __LINE__, "both commands should have finished");
+    assertEqualsInt(fixture.fake->cancelCount, 0, __LINE__, "the stale command should not cancel the one now holding its socket");
+}
+
+void testInquiryDuringMoves() {
+    Fixture fixture(2, 2);
+    fixture.fake->completes = false;
+    int finished = 0;
+    // Both command sockets are taken by moves that never complete; the inquiry must not wait for them.
+    fixture.executor.spawn(commandExpectingStatus(*fixture.camera, JR_VISCA_MESSAGE_ZOOM_DIRECT, jr_visca::Status::Timeout, std::chrono::milliseconds(30), &finished));
+    fixture.executor.spawn(commandExpectingStatus(*fixture.camera, JR_VISCA_MESSAGE_ZOOM_DIRECT, jr_visca::Status::Timeout, std::chrono::milliseconds(30), &finished));
+    fixture.executor.spawn(commandExpectingStatus(*fixture.camera, JR_VISCA_MESSAGE_ZOOM_POSITION_INQ, jr_visca::Status::Completed, std::chrono::milliseconds(20), &finished));
+    fixture.executor.addTimer(jr_visca::Clock::now() + std::chrono::milliseconds(50), [&fixture]() { fixture.executor.stop(); });
+    fixture.executor.run();
+    assertEqualsInt(finished, 3, __LINE__, "every command should have finished");
+}
+
+jr_visca::Task<> zoomExpectingStatus(jr_visca::Camera &camera, jr_visca::Status expected, std::chrono::milliseconds timeout, std::stop_token stopToken, jr_visca::Executor &executor) {
+    union jr_viscaMessageParameters parameters = {};
+    jr_visca::Reply reply = co_await camera.command(JR_VISCA_MESSAGE_ZOOM_DIRECT, parameters, timeout, stopToken);
+    assertEqualsInt((int)reply.status, (int)expected, __LINE__, "command should end with the expected status");
+    // Give the CANCEL a moment to reach the camera.
+    executor.addTimer(jr_visca::Clock::now() + std::chrono::milliseconds(5), [&executor]() { executor.stop(); });
+}
+
+void testTimeoutSendsCancel() {
+    Fixture fixture(2, 2);
+    fixture.fake->completes = false;
+    fixture.executor.spawn(zoomExpectingStatus(*fixture.camera, jr_visca::Status::Timeout, std::chrono::milliseconds(10), {}, fixture.executor));
+    fixture.executor.run();
+    assertEqualsInt(fixture.fake->cancelCount, 1, __LINE__, "timeout should cancel the command on the camera");
+}
+
+void testStopTokenSendsCancel() {
+    Fixture fixture(2, 2);
+    fixture.fake->completes = false;
+    std::stop_source stopSource;
+    fixture.executor.spawn(zoomExpectingStatus(*fixture.camera, jr_visca::Status::Cancelled, std::chrono::seconds(5), stopSource.get_token(), fixture.executor));
+    fixture.executor.addTimer(jr_visca::Clock::now() + std::chrono::milliseconds(5), [&stopSource]() { stopSource.request_stop(); });
+    fixture.executor.run();
+    assertEqualsInt(fixture.fake->cancelCount, 1, __LINE__, "stop request should cancel the command on the camera");
+}
+
+int main() {
+    printf("jr_visca_coro_tester\n");
+
+    testManyConcurrentCommands();
+    testBufferFullRetries();
+    testInquiry();
+    testInquiryBufferFullBacksOff();
+    testInquiryDuringMoves();
+    testRecoversFromLostReplies();
+    testLostCompletionSocketReuse();
+    testTimeoutSendsCancel();
+    testStopTokenSendsCancel();
+
+    return 0;
+}
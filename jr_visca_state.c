@@ -0,0 +1,348 @@
+/*
+    Copyright 2021 Jacob Rau
+
+    This file is part of libjr_visca.
+
+    libjr_visca is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libjr_visca is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libjr_visca.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "jr_visca_state.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define JR_VISCA_STATE_TABLE_MAGIC 0x4a525653 // "JRVS"
+#define JR_VISCA_STATE_TABLE_VERSION 2
+#define JR_VISCA_CACHE_LINE_SIZE 64
+// How many times `jr_viscaStateTableRead` tries for a consistent copy before giving up with EAGAIN.
+#define JR_VISCA_STATE_TABLE_READ_ATTEMPTS 10000
+
+/*
+ * Shared memory layout: one cache line of header, then one cache line per camera. `magic` is written
+ * last, so a reader that sees it also sees an initialized table. `retired` is set just before the table
+ * is unlinked, since readers can't otherwise tell that nobody publishes into their mapping any more.
+ */
+typedef struct {
+    alignas(JR_VISCA_CACHE_LINE_SIZE) _Atomic uint32_t magic;
+    uint32_t version;
+    uint32_t cameraCount;
+    uint32_t slotSize;
+    _Atomic uint32_t retired;
+} jr_viscaStateTableHeader;
+
+#define JR_VISCA_STATE_WORD_COUNT ((sizeof(struct jr_viscaCameraState) + sizeof(uint32_t) - 1) / sizeof(uint32_t))
+
+/*
+ * A camera's state as the words it is copied in and out of shared memory with.
+ */
+typedef union {
+    struct jr_viscaCameraState state;
+    uint32_t words[JR_VISCA_STATE_WORD_COUNT];
+} jr_viscaCameraStateWords;
+
+/*
+ * `sequence` is odd while the publisher is writing `state`. Readers copy `state` while it may be changing
+ * under them, so it is accessed only through relaxed atomic words: a torn copy is then merely discarded
+ * when `sequence` has moved, rather than being a data race.
+ */
+typedef struct {
+    alignas(JR_VISCA_CACHE_LINE_SIZE) _Atomic uint32_t sequence;
+    _Atomic uint32_t state[JR_VISCA_STATE_WORD_COUNT];
+} jr_viscaStateSlot;
+
+_Static_assert(sizeof(jr_viscaStateTableHeader) == JR_VISCA_CACHE_LINE_SIZE, "header should fill exactly one cache line");
+_Static_assert(sizeof(jr_viscaStateSlot) == JR_VISCA_CACHE_LINE_SIZE, "camera state should fill exactly one cache line");
+
+struct jr_viscaStateTable {
+    jr_viscaStateTableHeader *header;
+    jr_viscaStateSlot *slots;
+    size_t mappingLength;
+    bool writable;
+};
+
+static size_t _jr_viscaStateTableLength(int cameraCount) {
+    return sizeof(jr_viscaStateTableHeader) + (size_t)cameraCount * sizeof(jr_viscaStateSlot);
+}
+
+static struct jr_viscaStateTable *_jr_viscaStateTableMap(int fd, size_t length, bool writable) {
+    struct jr_viscaStateTable *table = malloc(sizeof(struct jr_viscaStateTable));
+    if (table == NULL) {
+        return NULL;
+    }
+
+    void *mapping = mmap(NULL, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        free(table);
+        return NULL;
+    }
+
+    table->header = mapping;
+    table->slots = (jr_viscaStateSlot *)((uint8_t *)mapping + sizeof(jr_viscaStateTableHeader));
+    table->mappingLength = length;
+    table->writable = writable;
+    return table;
+}
+
+/**
+ * Sets `retired` on the table `name`, if there is one with a header we recognize.
+ */
+static void _jr_viscaStateTableRetire(const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == 0 && (size_t)status.st_size >= sizeof(jr_viscaStateTableHeader)) {
+        jr_viscaStateTableHeader *header = mmap(NULL, sizeof(jr_viscaStateTableHeader), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (header != MAP_FAILED) {
+            if (atomic_load_explicit(&header->magic, memory_order_acquire) == JR_VISCA_STATE_TABLE_MAGIC) {
+                atomic_store_explicit(&header->retired, 1, memory_order_release);
+            }
+            munmap(header, sizeof(jr_viscaStateTableHeader));
+        }
+    }
+    close(fd);
+}
+
+struct jr_viscaStateTable *jr_viscaStateTableCreate(const char *name, int cameraCount, int flags) {
+    if (cameraCount <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // Replace rather than resize an existing table: shrinking memory that readers have mapped would crash
+    // them, whereas after unlinking they keep the old table and see it retired.
+    if (flags & JR_VISCA_STATE_TABLE_REPLACE) {
+        jr_viscaStateTableUnlink(name);
+    }
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    // A new object is zero-filled, so every camera starts out with no state and sequence 0.
+    size_t length = _jr_viscaStateTableLength(cameraCount);
+    if (ftruncate(fd, length) < 0) {
+        // Don't leave an empty object behind to block the next create and fail every open.
+        int savedErrno = errno;
+        close(fd);
+        shm_unlink(name);
+        errno = savedErrno;
+        return NULL;
+    }
+
+    struct jr_viscaStateTable *table = _jr_viscaStateTableMap(fd, length, true);
+    int savedErrno = errno;
+    close(fd);
+    if (table == NULL) {
+        shm_unlink(name);
+        errno = savedErrno;
+        return NULL;
+    }
+
+    table->header->version = JR_VISCA_STATE_TABLE_VERSION;
+    table->header->cameraCount = cameraCount;
+    table->header->slotSize = sizeof(jr_viscaStateSlot);
+    atomic_store_explicit(&table->header->magic, JR_VISCA_STATE_TABLE_MAGIC, memory_order_release);
+    return table;
+}
+
+struct jr_viscaStateTable *jr_viscaStateTableOpen(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) < 0) {
+        int savedErrno = errno;
+        close(fd);
+        errno = savedErrno;
+        return NULL;
+    }
+    if ((size_t)status.st_size < sizeof(jr_viscaStateTableHeader)) {
+        close(fd);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    struct jr_viscaStateTable *table = _jr_viscaStateTableMap(fd, status.st_size, false);
+    int savedErrno = errno;
+    close(fd);
+    if (table == NULL) {
+        errno = savedErrno;
+        return NULL;
+    }
+
+    jr_viscaStateTableHeader *header = table->header;
+    if (atomic_load_explicit(&header->magic, memory_order_acquire) != JR_VISCA_STATE_TABLE_MAGIC ||
+        header->version != JR_VISCA_STATE_TABLE_VERSION ||
+        header->slotSize != sizeof(jr_viscaStateSlot) ||
+        _jr_viscaStateTableLength(header->cameraCount) > table->mappingLength) {
+        jr_viscaStateTableClose(table);
+        errno = EPROTO;
+        return NULL;
+    }
+
+    return table;
+}
+
+void jr_viscaStateTableClose(struct jr_viscaStateTable *table) {
+    munmap(table->header, table->mappingLength);
+    free(table);
+}
+
+int jr_viscaStateTableUnlink(const char *name) {
+    _jr_viscaStateTableRetire(name);
+    return shm_unlink(name);
+}
+
+int jr_viscaStateTableCameraCount(struct jr_viscaStateTable *table) {
+    return table->header->cameraCount;
+}
+
+/**
+ * Returns camera `camera`'s slot for publishing, or NULL with `errno` set.
+ */
+static jr_viscaStateSlot *_jr_viscaStateTableWritableSlot(struct jr_viscaStateTable *table, int camera) {
+    if (!table->writable) {
+        errno = EBADF;
+        return NULL;
+    }
+    if (camera < 0 || camera >= (int)table->header->cameraCount) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return &table->slots[camera];
+}
+
+static struct jr_viscaCameraState _jr_viscaStateSlotLoad(jr_viscaStateSlot *slot) {
+    // Only the publisher writes, so its own copy can be read without the seqlock.
+    jr_viscaCameraStateWords current;
+    for (size_t i = 0; i < JR_VISCA_STATE_WORD_COUNT; i++) {
+        current.words[i] = atomic_load_explicit(&slot->state[i], memory_order_relaxed);
+    }
+    return current.state;
+}
+
+static void _jr_viscaStateSlotStore(jr_viscaStateSlot *slot, struct jr_viscaCameraState state) {
+    uint32_t sequence = atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+    atomic_store_explicit(&slot->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    jr_viscaCameraStateWords updated = { .state = state };
+    for (size_t i = 0; i < JR_VISCA_STATE_WORD_COUNT; i++) {
+        atomic_store_explicit(&slot->state[i], updated.words[i], memory_order_relaxed);
+    }
+    atomic_store_explicit(&slot->sequence, sequence + 2, memory_order_release);
+}
+
+int jr_viscaStateTablePublish(struct jr_viscaStateTable *table, int camera, int message, union jr_viscaMessageParameters *messageParameters, uint64_t nowNs) {
+    jr_viscaStateSlot *slot = _jr_viscaStateTableWritableSlot(table, camera);
+    if (slot == NULL) {
+        return -1;
+    }
+    struct jr_viscaCameraState state = _jr_viscaStateSlotLoad(slot);
+
+    switch (message) {
+        case JR_VISCA_MESSAGE_PAN_TILT_POSITION_INQ_RESPONSE:
+            state.panPosition = messageParameters->panTiltPositionInqResponseParameters.panPosition;
+            state.tiltPosition = messageParameters->panTiltPositionInqResponseParameters.tiltPosition;
+            state.panTiltUpdatedNs = nowNs;
+            break;
+        case JR_VISCA_MESSAGE_ZOOM_POSITION_INQ_RESPONSE:
+            state.zoomPosition = messageParameters->zoomPositionParameters.zoomPosition;
+            state.zoomUpdatedNs = nowNs;
+            break;
+        case JR_VISCA_MESSAGE_FOCUS_AUTOMATIC:
+        case JR_VISCA_MESSAGE_FOCUS_MANUAL:
+            state.focusMode = message == JR_VISCA_MESSAGE_FOCUS_AUTOMATIC ? JR_VISCA_FOCUS_MODE_AUTOMATIC : JR_VISCA_FOCUS_MODE_MANUAL;
+            state.focusModeUpdatedNs = nowNs;
+            break;
+        case JR_VISCA_MESSAGE_SYNTAX_ERROR:
+        case JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL:
+        case JR_VISCA_MESSAGE_COMMAND_NOT_EXECUTABLE:
+            state.lastError = message;
+            state.lastErrorNs = nowNs;
+            break;
+        default:
+            return 0;
+    }
+
+    _jr_viscaStateSlotStore(slot, state);
+    return 1;
+}
+
+int jr_viscaStateTablePublishBlockInqResponse(struct jr_viscaStateTable *table, int camera, int inquiry, struct jr_viscaBlockInqResponseParameters *parameters, uint64_t nowNs) {
+    jr_viscaStateSlot *slot = _jr_viscaStateTableWritableSlot(table, camera);
+    if (slot == NULL) {
+        return -1;
+    }
+    struct jr_viscaCameraStatus status;
+    if (jr_viscaDecodeBlockInqResponse(inquiry, parameters, &status) < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (inquiry != JR_VISCA_MESSAGE_LENS_BLOCK_INQ) {
+        // The camera block has nothing the table keeps.
+        return 0;
+    }
+
+    struct jr_viscaCameraState state = _jr_viscaStateSlotLoad(slot);
+    state.zoomPosition = status.zoomPosition;
+    state.zoomUpdatedNs = nowNs;
+    state.focusMode = status.focusMode;
+    state.focusModeUpdatedNs = nowNs;
+    _jr_viscaStateSlotStore(slot, state);
+    return 1;
+}
+
+int jr_viscaStateTableRead(struct jr_viscaStateTable *table, int camera, struct jr_viscaCameraState *state) {
+    if (camera < 0 || camera >= (int)table->header->cameraCount) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (atomic_load_explicit(&table->header->retired, memory_order_acquire)) {
+        errno = ESTALE;
+        return -1;
+    }
+
+    jr_viscaStateSlot *slot = &table->slots[camera];
+    // Bounded, because a publisher that died mid-update leaves `sequence` odd for good.
+    for (int attempt = 0; attempt < JR_VISCA_STATE_TABLE_READ_ATTEMPTS; attempt++) {
+        uint32_t before = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        if (before & 1) {
+            // Publisher is mid-update.
+            continue;
+        }
+        jr_viscaCameraStateWords copy;
+        for (size_t i = 0; i < JR_VISCA_STATE_WORD_COUNT; i++) {
+            copy.words[i] = atomic_load_explicit(&slot->state[i], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) == before) {
+            *state = copy.state;
+            return 0;
+        }
+    }
+
+    errno = EAGAIN;
+    return -1;
+}
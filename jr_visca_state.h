@@ -0,0 +1,130 @@
+/*
+    Copyright 2021 Jacob Rau
+
+    This file is part of libjr_visca.
+
+    libjr_visca is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    libjr_visca is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with libjr_visca.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef JR_VISCA_STATE_H
+#define JR_VISCA_STATE_H
+
+#include "jr_visca.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Shared-memory camera state table (POSIX).
+ *
+ * One process (the one talking to the cameras) creates the table and publishes every decoded reply into
+ * it. Any number of local processes open it read-only and read the latest state with no syscalls and no
+ * extra camera traffic. Each camera gets its own cache line, versioned with a seqlock: the publisher never
+ * waits on readers, and readers retry the copy if it raced with an update.
+ *
+ * There must be only one publisher per table.
+ */
+
+struct jr_viscaCameraState {
+    int16_t panPosition;
+    int16_t tiltPosition;
+    int16_t zoomPosition;
+    // JR_VISCA_FOCUS_MODE_*
+    uint8_t focusMode;
+    // Last error reply (JR_VISCA_MESSAGE_SYNTAX_ERROR, _COMMAND_BUFFER_FULL or _COMMAND_NOT_EXECUTABLE), or 0.
+    int lastError;
+    // Timestamps as passed to `jr_viscaStateTablePublish`, 0 if never updated.
+    uint64_t panTiltUpdatedNs;
+    uint64_t zoomUpdatedNs;
+    uint64_t focusModeUpdatedNs;
+    uint64_t lastErrorNs;
+};
+
+struct jr_viscaStateTable;
+
+// Flags for `jr_viscaStateTableCreate`.
+#define JR_VISCA_STATE_TABLE_REPLACE 1
+
+/**
+ * Creates the shared-memory table `name` (e.g. "/jr_visca") with room for `cameraCount` cameras, all
+ * zeroed, and maps it for publishing.
+ *
+ * If a table of the same name exists, fails with `EEXIST` unless `flags` has `JR_VISCA_STATE_TABLE_REPLACE`
+ * (e.g. a publisher restarting). Replacing marks the old table retired before unlinking it, so readers
+ * still mapping it get `ESTALE` from `jr_viscaStateTableRead` and know to reopen.
+ *
+ * Returns NULL on failure, with `errno` set.
+ */
+struct jr_viscaStateTable *jr_viscaStateTableCreate(const char *name, int cameraCount, int flags);
+
+/**
+ * Maps an existing table read-only.
+ *
+ * Returns NULL on failure, with `errno` set. A table that exists but was written by an incompatible
+ * version of this library fails with `EPROTO`.
+ */
+struct jr_viscaStateTable *jr_viscaStateTableOpen(const char *name);
+
+/**
+ * Unmaps `table`. The shared memory stays around for other processes until `jr_viscaStateTableUnlink`.
+ */
+void jr_viscaStateTableClose(struct jr_viscaStateTable *table);
+
+/**
+ * Marks the table `name` retired and removes it. Processes that have it mapped can still read it, but
+ * `jr_viscaStateTableRead` fails with `ESTALE`.
+ */
+int jr_viscaStateTableUnlink(const char *name);
+
+int jr_viscaStateTableCameraCount(struct jr_viscaStateTable *table);
+
+/**
+ * Applies a decoded reply from camera `camera` (0-based index into the table) to its state.
+ *
+ * Understands PAN_TILT_POSITION_INQ_RESPONSE, ZOOM_POSITION_INQ_RESPONSE, the error replies, and
+ * FOCUS_AUTOMATIC / FOCUS_MANUAL (publish those once the camera has completed the command). `nowNs` is
+ * stored as the update timestamp; use a clock every reader agrees on, such as CLOCK_REALTIME.
+ *
+ * Returns 1 if the state changed, 0 if `message` carries no state, or -1 with `errno` set: `EINVAL` if
+ * `camera` is out of range, `EBADF` if the table was opened read-only.
+ */
+int jr_viscaStateTablePublish(struct jr_viscaStateTable *table, int camera, int message, union jr_viscaMessageParameters *messageParameters, uint64_t nowNs);
+
+/**
+ * Applies a BLOCK_INQ_RESPONSE answering `inquiry` (`JR_VISCA_MESSAGE_LENS_BLOCK_INQ` or
+ * `JR_VISCA_MESSAGE_CAMERA_BLOCK_INQ`) from camera `camera`. A lens block reply updates zoom position and
+ * focus mode, with their timestamps, in one go. The camera block has nothing the table keeps. Block
+ * inquiries don't report pan/tilt; keep publishing PAN_TILT_POSITION_INQ_RESPONSE for that.
+ *
+ * Returns 1 if the state changed, 0 if the reply carries nothing the table keeps, or -1 with `errno` set:
+ * `EINVAL` if `camera` is out of range or `inquiry` is not a block inquiry, `EBADF` if the table was
+ * opened read-only.
+ */
+int jr_viscaStateTablePublishBlockInqResponse(struct jr_viscaStateTable *table, int camera, int inquiry, struct jr_viscaBlockInqResponseParameters *parameters, uint64_t nowNs);
+
+/**
+ * Copies a consistent snapshot of camera `camera` into `state`.
+ *
+ * Returns 0, or -1 with `errno` set and `state` untouched: `EINVAL` if `camera` is out of range, `ESTALE`
+ * if the table has been replaced or unlinked (close it and open it again), or `EAGAIN` if the publisher
+ * stayed mid-update for as long as this was willing to spin (it was descheduled, or died mid-update).
+ */
+int jr_viscaStateTableRead(struct jr_viscaStateTable *table, int camera, struct jr_viscaCameraState *state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
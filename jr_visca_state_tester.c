@@ -0,0 +1,213 @@
+#include <jr_visca_state.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+void bail(int line, char *message) {
+    fprintf(stderr, "line %d: %s\n", line, message);
+    exit(-1);
+}
+
+void assertEqualsInt(int actual, int expected, int line, char *message) {
+    if (actual != expected) {
+        printf("expected %d, actual %d\n", expected, actual);
+        bail(line, message);
+    }
+}
+
+void testPublishAndRead(char *name) {
+    struct jr_viscaStateTable *publisher = jr_viscaStateTableCreate(name, 4, JR_VISCA_STATE_TABLE_REPLACE);
+    if (publisher == NULL) {
+        bail(__LINE__, "create should succeed");
+    }
+    struct jr_viscaStateTable *reader = jr_viscaStateTableOpen(name);
+    if (reader == NULL) {
+        bail(__LINE__, "open should succeed");
+    }
+    assertEqualsInt(jr_viscaStateTableCameraCount(reader), 4, __LINE__, "reader should see the camera count");
+
+    union jr_viscaMessageParameters parameters;
+    parameters.panTiltPositionInqResponseParameters.panPosition = 0x1234;
+    parameters.panTiltPositionInqResponseParameters.tiltPosition = -5;
+    assertEqualsInt(jr_viscaStateTablePublish(publisher, 2, JR_VISCA_MESSAGE_PAN_TILT_POSITION_INQ_RESPONSE, &parameters, 100), 1, __LINE__, "pan/tilt response should update state");
+    parameters.zoomPositionParameters.zoomPosition = 0x4000;
+    assertEqualsInt(jr_viscaStateTablePublish(publisher, 2, JR_VISCA_MESSAGE_ZOOM_POSITION_INQ_RESPONSE, &parameters, 200), 1, __LINE__, "zoom response should update state");
+    assertEqualsInt(jr_viscaStateTablePublish(publisher, 2, JR_VISCA_MESSAGE_FOCUS_MANUAL, &parameters, 300), 1, __LINE__, "focus mode should update state");
+    assertEqualsInt(jr_viscaStateTablePublish(publisher, 2, JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL, &parameters, 400), 1, __LINE__, "error should update state");
+    assertEqualsInt(jr_viscaStateTablePublish(publisher, 2, JR_VISCA_MESSAGE_ACK, &parameters, 500), 0, __LINE__, "ACK carries no state");
+    assertEqualsInt(jr_viscaStateTablePublish(publisher, 4, JR_VISCA_MESSAGE_ACK, &parameters, 500), -1, __LINE__, "camera index should be checked");
+    assertEqualsInt(errno, EINVAL, __LINE__, "bad camera index should report EINVAL");
+    assertEqualsInt(jr_viscaStateTablePublish(reader, 2, JR_VISCA_MESSAGE_FOCUS_AUTOMATIC, &parameters, 500), -1, __LINE__, "reader should not be able to publish");
+    assertEqualsInt(errno, EBADF, __LINE__, "publishing to a read-only table should report EBADF");
+
+    struct jr_viscaCameraState state;
+    assertEqualsInt(jr_viscaStateTableRead(reader, 2, &state), 0, __LINE__, "read should succeed");
+    assertEqualsInt(state.panPosition, 0x1234, __LINE__, "pan position");
+    assertEqualsInt(state.tiltPosition, -5, __LINE__, "tilt position");
+    assertEqualsInt(state.zoomPosition, 0x4000, __LINE__, "zoom position");
+    assertEqualsInt(state.focusMode, JR_VISCA_FOCUS_MODE_MANUAL, __LINE__, "focus mode");
+    assertEqualsInt(state.lastError, JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL, __LINE__, "last error");
+    assertEqualsInt((int)state.panTiltUpdatedNs, 100, __LINE__, "pan/tilt timestamp");
+    assertEqualsInt((int)state.lastErrorNs, 400, __LINE__, "error timestamp");
+
+    assertEqualsInt(jr_viscaStateTableRead(reader, 0, &state), 0, __LINE__, "read should succeed");
+    assertEqualsInt((int)state.panTiltUpdatedNs, 0, __LINE__, "untouched camera should be zeroed");
+
+    jr_viscaStateTableClose(reader);
+    jr_viscaStateTableClose(publisher);
+}
+
+void testConcurrentProcesses(char *name) {
+    const int updates = 200000;
+    struct jr_viscaStateTable *publisher = jr_viscaStateTableCreate(name, 1, JR_VISCA_STATE_TABLE_REPLACE);
+    if (publisher == NULL) {
+        bail(__LINE__, "create should succeed");
+    }
+
+    pid_t child = fork();
+    if (child == 0) {
+        // Pan and tilt are always published equal, so a torn read would show them differing.
+        union jr_viscaMessageParameters parameters;
+        for (int i = 1; i <= updates; i++) {
+            parameters.panTiltPositionInqResponseParameters.panPosition = i;
+            parameters.panTiltPositionInqResponseParameters.tiltPosition = i;
+            jr_viscaStateTablePublish(publisher, 0, JR_VISCA_MESSAGE_PAN_TILT_POSITION_INQ_RESPONSE, &parameters, i);
+        }
+        _exit(0);
+    }
+
+    struct jr_viscaStateTable *reader = jr_viscaStateTableOpen(name);
+    if (reader == NULL) {
+        bail(__LINE__, "open should succeed");
+    }
+    struct jr_viscaCameraState state = {0};
+    do {
+        if (jr_viscaStateTableRead(reader, 0, &state) < 0) {
+            // EAGAIN if the publisher was descheduled mid-update; `state` is left as it was.
+            assertEqualsInt(errno, EAGAIN, __LINE__, "read should only fail while the publisher is mid-update");
+        }
+        assertEqualsInt(state.tiltPosition, state.panPosition, __LINE__, "read should never be torn");
+        assertEqualsInt((int16_t)state.panTiltUpdatedNs, state.panPosition, __LINE__, "timestamp should match the position it was published with");
+    } while (state.panTiltUpdatedNs != (uint64_t)updates);
+
+    int status;
+    waitpid(child, &status, 0);
+    jr_viscaStateTableClose(reader);
+    jr_viscaStateTableClose(publisher);
+}
+
+void testReplace(char *name) {
+    struct jr_viscaStateTable *publisher = jr_viscaStateTableCreate(name, 1, JR_VISCA_STATE_TABLE_REPLACE);
+    if (publisher == NULL) {
+        bail(__LINE__, "create should succeed");
+    }
+    struct jr_viscaStateTable *reader = jr_viscaStateTableOpen(name);
+    if (reader == NULL) {
+        bail(__LINE__, "open should succeed");
+    }
+
+    errno = 0;
+    if (jr_viscaStateTableCreate(name, 1, 0) != NULL) {
+        bail(__LINE__, "second publisher should not silently take over the table");
+    }
+    assertEqualsInt(errno, EEXIST, __LINE__, "second publisher should fail with EEXIST");
+    struct jr_viscaCameraState state;
+    assertEqualsInt(jr_viscaStateTableRead(reader, 0, &state), 0, __LINE__, "table should still be live");
+
+    struct jr_viscaStateTable *restarted = jr_viscaStateTableCreate(name, 1, JR_VISCA_STATE_TABLE_REPLACE);
+    if (restarted == NULL) {
+        bail(__LINE__, "replacing create should succeed");
+    }
+    assertEqualsInt(jr_viscaStateTableRead(reader, 0, &state), -1, __LINE__, "old table should be retired");
+    assertEqualsInt(errno, ESTALE, __LINE__, "retired table should report ESTALE");
+    assertEqualsInt(jr_viscaStateTableRead(reader, 1, &state), -1, __LINE__, "camera index should be checked");
+    assertEqualsInt(errno, EINVAL, __LINE__, "bad camera index should report EINVAL");
+
+    jr_viscaStateTableClose(reader);
+    reader = jr_viscaStateTableOpen(name);
+    if (reader == NULL) {
+        bail(__LINE__, "reopen should succeed");
+    }
+    assertEqualsInt(jr_viscaStateTableRead(reader, 0, &state), 0, __LINE__, "reopened table should be live");
+
+    jr_viscaStateTableClose(reader);
+    jr_viscaStateTableClose(restarted);
+    jr_viscaStateTableClose(publisher);
+}
+
+void testBlockInquiry(char *name) {
+    struct jr_viscaStateTable *publisher = jr_viscaStateTableCreate(name, 1, JR_VISCA_STATE_TABLE_REPLACE);
+    if (publisher == NULL) {
+        bail(__LINE__, "create should succeed");
+    }
+
+    // Lens block: zoom 0x1234, focus near limit, focus position, xx = 0x09 (auto focus), z.
+    struct jr_viscaBlockInqResponseParameters parameters = {{0x01, 0x02, 0x03, 0x04, 0x0a, 0x0b, 0x05, 0x06, 0x07, 0x08, 0x00, 0x09, 0x03}};
+    assertEqualsInt(jr_viscaStateTablePublishBlockInqResponse(publisher, 0, JR_VISCA_MESSAGE_LENS_BLOCK_INQ, &parameters, 100), 1, __LINE__, "lens block should update state");
+    assertEqualsInt(jr_viscaStateTablePublishBlockInqResponse(publisher, 0, JR_VISCA_MESSAGE_CAMERA_BLOCK_INQ, &parameters, 200), 0, __LINE__, "camera block carries no table state");
+    assertEqualsInt(jr_viscaStateTablePublishBlockInqResponse(publisher, 0, JR_VISCA_MESSAGE_ZOOM_POSITION_INQ, &parameters, 200), -1, __LINE__, "inquiry should be checked");
+    assertEqualsInt(errno, EINVAL, __LINE__, "non-block inquiry should report EINVAL");
+
+    struct jr_viscaCameraState state;
+    assertEqualsInt(jr_viscaStateTableRead(publisher, 0, &state), 0, __LINE__, "read should succeed");
+    assertEqualsInt(state.zoomPosition, 0x1234, __LINE__, "zoom position");
+    assertEqualsInt(state.focusMode, JR_VISCA_FOCUS_MODE_AUTOMATIC, __LINE__, "focus mode");
+    assertEqualsInt((int)state.zoomUpdatedNs, 100, __LINE__, "zoom timestamp");
+    assertEqualsInt((int)state.focusModeUpdatedNs, 100, __LINE__, "focus mode timestamp");
+    assertEqualsInt((int)state.panTiltUpdatedNs, 0, __LINE__, "block inquiries don't report pan/tilt");
+
+    jr_viscaStateTableClose(publisher);
+}
+
+void testStuckPublisher(char *name) {
+    struct jr_viscaStateTable *publisher = jr_viscaStateTableCreate(name, 1, JR_VISCA_STATE_TABLE_REPLACE);
+    if (publisher == NULL) {
+        bail(__LINE__, "create should succeed");
+    }
+    struct jr_viscaStateTable *reader = jr_viscaStateTableOpen(name);
+    if (reader == NULL) {
+        bail(__LINE__, "open should succeed");
+    }
+
+    // Pretend the publisher died mid-update by leaving camera 0's sequence (the first word after the
+    // one-cache-line header) odd.
+    int fd = shm_open(name, O_RDWR, 0);
+    uint32_t *mapping = mmap(NULL, 128, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        bail(__LINE__, "raw mapping should succeed");
+    }
+    mapping[64 / sizeof(uint32_t)] = 1;
+
+    struct jr_viscaCameraState state;
+    errno = 0;
+    assertEqualsInt(jr_viscaStateTableRead(reader, 0, &state), -1, __LINE__, "read should give up rather than spin forever");
+    assertEqualsInt(errno, EAGAIN, __LINE__, "stuck publisher should report EAGAIN");
+
+    mapping[64 / sizeof(uint32_t)] = 2;
+    assertEqualsInt(jr_viscaStateTableRead(reader, 0, &state), 0, __LINE__, "read should succeed once the update finishes");
+
+    munmap(mapping, 128);
+    jr_viscaStateTableClose(reader);
+    jr_viscaStateTableClose(publisher);
+}
+
+int main() {
+    printf("jr_visca_state_tester\n");
+
+    char name[64];
+    snprintf(name, sizeof(name), "/jr_visca_state_tester_%d", (int)getpid());
+
+    testPublishAndRead(name);
+    testConcurrentProcesses(name);
+    testReplace(name);
+    testBlockInquiry(name);
+    testStuckPublisher(name);
+
+    jr_viscaStateTableUnlink(name);
+    return 0;
+}
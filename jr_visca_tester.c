@@ -62,6 +62,35 @@ void testAckDecode() {
     assertEqualsBuffer(&parameters.ackCompletionParameters.socketNumber, &expectedSocket, 1, __LINE__, "decoded ACK socket number wrong");
 }
 
+void testExactLengthDecode() {
+    // COMPLETION (50) and PAN_TILT_POSITION_INQ_RESPONSE (50 0p 0p 0p 0p 0t 0t 0t 0t) share a prefix, so
+    // only the frame length tells them apart.
+    uint8_t encoded[] = {
+        0x90, 0x50, 0xff,
+        0x90, 0x50, 0x01, 0x02, 0x03, 0x04, 0x0f, 0x0f, 0x0f, 0x0b, 0xff
+    };
+    int message = 0;
+    union jr_viscaMessageParameters parameters;
+    uint8_t sender = 0;
+    uint8_t receiver = 0;
+    int result = jr_viscaDecodeMessage(encoded, sizeof(encoded), &message, &parameters, &sender, &receiver);
+    assertEqualsInt(result, 3, __LINE__, "decode should consume only the first frame");
+    assertEqualsInt(message, JR_VISCA_MESSAGE_COMPLETION, __LINE__, "3-byte 50 frame should decode as COMPLETION");
+    assertEqualsInt(parameters.ackCompletionParameters.socketNumber, 0, __LINE__, "decoded COMPLETION socket number wrong");
+
+    result = jr_viscaDecodeMessage(encoded + 3, sizeof(encoded) - 3, &message, &parameters, &sender, &receiver);
+    assertEqualsInt(result, 11, __LINE__, "decode should consume the entire frame");
+    assertEqualsInt(message, JR_VISCA_MESSAGE_PAN_TILT_POSITION_INQ_RESPONSE, __LINE__, "9-byte 50 frame should decode as PAN_TILT_POSITION_INQ_RESPONSE, not COMPLETION");
+    assertEqualsInt(parameters.panTiltPositionInqResponseParameters.panPosition, 0x1234, __LINE__, "decoded pan position wrong");
+    assertEqualsInt(parameters.panTiltPositionInqResponseParameters.tiltPosition, -5, __LINE__, "decoded tilt position wrong");
+
+    // A known prefix with trailing bytes matches nothing.
+    uint8_t trailing[] = {0x90, 0x41, 0x00, 0xff};
+    result = jr_viscaDecodeMessage(trailing, sizeof(trailing), &message, &parameters, &sender, &receiver);
+    assertEqualsInt(result, 4, __LINE__, "decode should consume the entire frame");
+    assertEqualsInt(message, -1, __LINE__, "ACK with trailing bytes should be unrecognized");
+}
+
 void testAckEncode() {
     union jr_viscaMessageParameters parameters;
     parameters.ackCompletionParameters.socketNumber = 3;
@@ -69,12 +98,228 @@ void testAckEncode() {
     assertEncodedMessage(JR_VISCA_MESSAGE_ACK, parameters, 1, 0, expectedData, sizeof(expectedData), __LINE__);
 }
 
+void testErrorDecode() {
+    uint8_t encoded[] = {0x90, 0x61, 0x02, 0xff, 0x90, 0x62, 0x03, 0xff, 0x90, 0x60, 0x41, 0xff, 0x90, 0x61, 0x05, 0xff};
+    int expectedMessages[] = {JR_VISCA_MESSAGE_SYNTAX_ERROR, JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL, JR_VISCA_MESSAGE_COMMAND_NOT_EXECUTABLE, JR_VISCA_MESSAGE_NO_SOCKET};
+    int offset = 0;
+    for (int i = 0; i < 4; i++) {
+        int message = 0;
+        union jr_viscaMessageParameters parameters;
+        uint8_t sender = 0;
+        uint8_t receiver = 0;
+        int result = jr_viscaDecodeMessage(encoded + offset, sizeof(encoded) - offset, &message, &parameters, &sender, &receiver);
+        assertEqualsInt(result, 4, __LINE__, "decode should consume the entire error frame");
+        assertEqualsInt(message, expectedMessages[i], __LINE__, "decoded message type should be the error reply");
+        assertEqualsInt(parameters.ackCompletionParameters.socketNumber, (i + 1) % 3, __LINE__, "decoded error socket number wrong");
+        offset += result;
+    }
+}
+
+void testFlowControl() {
+    struct jr_viscaFlowControl flowControl;
+    jr_viscaFlowControlInit(&flowControl, 2);
+
+    assertEqualsInt(jr_viscaFlowControlCanSend(&flowControl, 0), 1, __LINE__, "should be able to send initially");
+    jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+    jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+    assertEqualsInt(jr_viscaFlowControlCanSend(&flowControl, 0), 0, __LINE__, "window should be full");
+
+    assertEqualsInt(jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL, -1, 100), JR_VISCA_FLOW_CONTROL_RETRY, __LINE__, "buffer full should ask for a retry");
+    assertEqualsInt(flowControl.window, 1, __LINE__, "buffer full should halve the window");
+    assertEqualsInt(jr_viscaFlowControlCanSend(&flowControl, 100), 0, __LINE__, "window of 1 is still occupied");
+
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_COMPLETION, -1, 101);
+    assertEqualsInt(jr_viscaFlowControlCanSend(&flowControl, 101), 0, __LINE__, "should be backing off");
+    assertEqualsInt(jr_viscaFlowControlCanSend(&flowControl, 100 + JR_VISCA_FLOW_CONTROL_INITIAL_BACKOFF_MS), 1, __LINE__, "backoff should have expired");
+
+    jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL, -1, 200);
+    assertEqualsInt(flowControl.backoffMs, JR_VISCA_FLOW_CONTROL_INITIAL_BACKOFF_MS * 2, __LINE__, "repeated buffer full should double the backoff");
+
+    jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_ACK, -1, 300);
+    assertEqualsInt(flowControl.backoffMs, JR_VISCA_FLOW_CONTROL_INITIAL_BACKOFF_MS * 2, __LINE__, "a single ACK should not reset the backoff");
+    assertEqualsInt(flowControl.window, 1, __LINE__, "window should stay below the size that overran the camera");
+    for (int i = 0; i < JR_VISCA_FLOW_CONTROL_BACKOFF_RESET_ACKS; i++) {
+        jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_COMPLETION, -1, 301);
+        jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+        jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_ACK, -1, 302);
+    }
+    assertEqualsInt(flowControl.backoffMs, 0, __LINE__, "a run of ACKs should reset the backoff");
+    assertEqualsInt(flowControl.window, 1, __LINE__, "window should still stay below the ceiling");
+
+    // Without a ceiling, the window grows back after a full window's worth of ACKs.
+    jr_viscaFlowControlInit(&flowControl, 4);
+    for (int i = 0; i < 4; i++) {
+        jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+    }
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL, -1, 0);
+    assertEqualsInt(flowControl.window, 2, __LINE__, "buffer full should halve the window");
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_ACK, -1, 1);
+    assertEqualsInt(flowControl.window, 2, __LINE__, "window should not grow on the first ACK");
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_ACK, -1, 1);
+    assertEqualsInt(flowControl.window, 3, __LINE__, "window should grow after a full window of ACKs");
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_ACK, -1, 1);
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_ACK, -1, 1);
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_ACK, -1, 1);
+    assertEqualsInt(flowControl.window, 3, __LINE__, "window should not reach the ceiling");
+
+    // A buffer-full reply with one command in flight (e.g. another controller held a socket) doesn't
+    // say how many sockets the camera has.
+    jr_viscaFlowControlInit(&flowControl, 2);
+    jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL, -1, 0);
+    assertEqualsInt(flowControl.ceiling, 0, __LINE__, "a single command overrunning should not set a ceiling");
+    for (int i = 0; i < 4; i++) {
+        jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+        jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_ACK, -1, 100);
+        jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_COMPLETION, -1, 100);
+    }
+    assertEqualsInt(flowControl.window, 2, __LINE__, "window should grow back to the camera's sockets");
+
+    // A ceiling is forgotten after a long run of successes.
+    jr_viscaFlowControlInit(&flowControl, 2);
+    jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+    jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL, -1, 0);
+    assertEqualsInt(flowControl.ceiling, 2, __LINE__, "two commands overrunning should set a ceiling");
+    for (int i = 0; i < JR_VISCA_FLOW_CONTROL_CEILING_RESET_ACKS; i++) {
+        jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_COMPLETION, -1, 100);
+        jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+        jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_ACK, -1, 100);
+    }
+    assertEqualsInt(flowControl.ceiling, 0, __LINE__, "a long run of ACKs should clear the ceiling");
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_COMPLETION, -1, 100);
+    jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_ACK, -1, 100);
+    assertEqualsInt(flowControl.window, 2, __LINE__, "window should grow again once the ceiling is gone");
+
+    // Inquiries don't use a command socket.
+    jr_viscaFlowControlInit(&flowControl, 1);
+    jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+    jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_PAN_TILT_POSITION_INQ);
+    assertEqualsInt(flowControl.inFlight, 1, __LINE__, "inquiry should not count against the window");
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_PAN_TILT_POSITION_INQ_RESPONSE, -1, 0);
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_SYNTAX_ERROR, JR_VISCA_MESSAGE_LENS_BLOCK_INQ, 0);
+    assertEqualsInt(flowControl.inFlight, 1, __LINE__, "inquiry replies should not free the command's slot");
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_COMPLETION, JR_VISCA_MESSAGE_ZOOM_DIRECT, 0);
+    assertEqualsInt(flowControl.inFlight, 0, __LINE__, "completion should free the command's slot");
+
+    // Giving up on a command frees its slot even if no reply ever arrives.
+    jr_viscaFlowControlInit(&flowControl, 1);
+    jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+    assertEqualsInt(jr_viscaFlowControlCanSend(&flowControl, 0), 0, __LINE__, "window should be full");
+    jr_viscaFlowControlCommandAbandoned(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+    assertEqualsInt(jr_viscaFlowControlCanSend(&flowControl, 0), 1, __LINE__, "abandoning should free the slot");
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_COMPLETION, -1, 0);
+    assertEqualsInt(flowControl.inFlight, 0, __LINE__, "a late reply should not drive the count negative");
+
+    // A wrapped millisecond counter must not unblock early.
+    jr_viscaFlowControlInit(&flowControl, 1);
+    jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+    jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL, -1, 0xfffffffe);
+    assertEqualsInt(jr_viscaFlowControlCanSend(&flowControl, 2), 0, __LINE__, "backoff should survive counter wraparound");
+}
+
+void testBlockInquiry() {
+    union jr_viscaMessageParameters parameters;
+    uint8_t expectedInquiry[] = {0x81, 0x09, 0x7e, 0x7e, 0x00, 0xff};
+    assertEncodedMessage(JR_VISCA_MESSAGE_LENS_BLOCK_INQ, parameters, 0, 1, expectedInquiry, sizeof(expectedInquiry), __LINE__);
+
+    struct jr_viscaCameraStatus status;
+    memset(&status, 0, sizeof(status));
+    int message = 0;
+    uint8_t sender = 0;
+    uint8_t receiver = 0;
+
+    //                       50    zoom 0x1234             near 0xab   focus 0x5678            00    xx    0z
+    uint8_t lensReply[] = {0x90, 0x50, 0x01, 0x02, 0x03, 0x04, 0x0a, 0x0b, 0x05, 0x06, 0x07, 0x08, 0x00, 0x09, 0x03, 0xff};
+    int result = jr_viscaDecodeMessage(lensReply, sizeof(lensReply), &message, &parameters, &sender, &receiver);
+    assertEqualsInt(result, sizeof(lensReply), __LINE__, "decode should consume the entire block reply");
+    assertEqualsInt(message, JR_VISCA_MESSAGE_BLOCK_INQ_RESPONSE, __LINE__, "block reply should not be mistaken for a position reply");
+    assertEqualsInt(jr_viscaDecodeBlockInqResponse(JR_VISCA_MESSAGE_LENS_BLOCK_INQ, &parameters.blockInqResponseParameters, &status), 0, __LINE__, "lens block should decode");
+    assertEqualsInt(status.zoomPosition, 0x1234, __LINE__, "zoom position");
+    assertEqualsInt(status.focusNearLimit, 0xab, __LINE__, "focus near limit");
+    assertEqualsInt(status.focusPosition, 0x5678, __LINE__, "focus position");
+    assertEqualsInt(status.focusMode, JR_VISCA_FOCUS_MODE_AUTOMATIC, __LINE__, "focus mode");
+    assertEqualsInt(status.afMode, 1, __LINE__, "AF mode");
+    assertEqualsInt(status.zooming, 1, __LINE__, "zooming");
+    assertEqualsInt(status.focusing, 1, __LINE__, "focusing");
+    assertEqualsInt(status.lowContrast, 0, __LINE__, "low contrast");
+
+    //                         50    R gain 0x1f   B gain 0x20   r     s     tt    0u    vv    ww    bright 0x0c   0z
+    uint8_t cameraReply[] = {0x90, 0x50, 0x01, 0x0f, 0x02, 0x00, 0x05, 0x03, 0x03, 0x04, 0x11, 0x0d, 0x00, 0x0c, 0x07, 0xff};
+    result = jr_viscaDecodeMessage(cameraReply, sizeof(cameraReply), &message, &parameters, &sender, &receiver);
+    assertEqualsInt(message, JR_VISCA_MESSAGE_BLOCK_INQ_RESPONSE, __LINE__, "decoded message type should be a block reply");
+    assertEqualsInt(jr_viscaDecodeBlockInqResponse(JR_VISCA_MESSAGE_CAMERA_BLOCK_INQ, &parameters.blockInqResponseParameters, &status), 0, __LINE__, "camera block should decode");
+    assertEqualsInt(status.rGain, 0x1f, __LINE__, "R gain");
+    assertEqualsInt(status.bGain, 0x20, __LINE__, "B gain");
+    assertEqualsInt(status.whiteBalanceMode, 5, __LINE__, "white balance mode");
+    assertEqualsInt(status.exposureMode, 3, __LINE__, "exposure mode");
+    assertEqualsInt(status.backLight, 1, __LINE__, "back light");
+    assertEqualsInt(status.shutterPosition, 0x11, __LINE__, "shutter position");
+    assertEqualsInt(status.irisPosition, 0x0d, __LINE__, "iris position");
+    assertEqualsInt(status.brightPosition, 0x0c, __LINE__, "bright position");
+    assertEqualsInt(status.exposureCompPosition, 7, __LINE__, "exposure comp position");
+    assertEqualsInt(status.zoomPosition, 0x1234, __LINE__, "camera block should leave lens fields alone");
+
+    assertEqualsInt(jr_viscaDecodeBlockInqResponse(JR_VISCA_MESSAGE_ZOOM_POSITION_INQ, &parameters.blockInqResponseParameters, &status), -1, __LINE__, "non-block inquiry should be rejected");
+}
+
+/**
+ * Drives `commandCount` commands through flow control configured for `maxInFlight` sockets against a
+ * simulated camera that really has `cameraSockets`, each command taking 5ms. Returns the number of
+ * buffer-full replies seen after the first `warmUpCommands` commands were accepted.
+ */
+int simulateFlowControl(int maxInFlight, int cameraSockets, int commandCount, int warmUpCommands) {
+    struct jr_viscaFlowControl flowControl;
+    jr_viscaFlowControlInit(&flowControl, maxInFlight);
+    uint32_t completionTimes[16];
+    int busySockets = 0;
+    int accepted = 0;
+    int lateBufferFullCount = 0;
+
+    for (uint32_t now = 0; accepted < commandCount; now++) {
+        for (int i = 0; i < busySockets; i++) {
+            if (completionTimes[i] == now) {
+                completionTimes[i--] = completionTimes[--busySockets];
+                jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_COMPLETION, -1, now);
+            }
+        }
+        while (accepted < commandCount && jr_viscaFlowControlCanSend(&flowControl, now)) {
+            jr_viscaFlowControlCommandSent(&flowControl, JR_VISCA_MESSAGE_ZOOM_DIRECT);
+            if (busySockets == cameraSockets) {
+                if (accepted >= warmUpCommands) {
+                    lateBufferFullCount++;
+                }
+                jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_COMMAND_BUFFER_FULL, -1, now);
+                continue;
+            }
+            completionTimes[busySockets++] = now + 5;
+            accepted++;
+            jr_viscaFlowControlHandleReply(&flowControl, JR_VISCA_MESSAGE_ACK, -1, now);
+        }
+    }
+    return lateBufferFullCount;
+}
+
+void testFlowControlSettles() {
+    assertEqualsInt(simulateFlowControl(2, 1, 400, 10), 0, __LINE__, "buffer-full replies should stop once the window has settled");
+    assertEqualsInt(simulateFlowControl(4, 3, 400, 10), 0, __LINE__, "buffer-full replies should stop once the window has settled");
+    assertEqualsInt(simulateFlowControl(2, 2, 400, 0), 0, __LINE__, "a correctly sized window should never overrun the camera");
+}
+
 int main() {
     printf("jr_visca_tester\n");
 
     testEncodeMessage();
     testAckDecode();
+    testExactLengthDecode();
     testAckEncode();
+    testErrorDecode();
+    testFlowControl();
+    testFlowControlSettles();
+    testBlockInquiry();
 
     return 0;
 }